@@ -0,0 +1,56 @@
+#include "arena.h"
+
+#include <cstring>
+
+Arena::Arena(size_t initial_size)
+        : buffer_(initial_size, &upstream_)
+        , strings_(&buffer_)
+{
+}
+
+void * Arena::Upstream::do_allocate(size_t bytes, size_t alignment)
+{
+        ++blocks;
+        this->bytes += bytes;
+        return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+}
+
+void Arena::Upstream::do_deallocate(void * p, size_t bytes, size_t alignment)
+{
+        std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+}
+
+void * Arena::do_allocate(size_t bytes, size_t alignment)
+{
+        std::lock_guard<std::mutex> lock(mutex_);
+        ++stats_.allocations;
+        stats_.bytes += bytes;
+        return buffer_.allocate(bytes, alignment);
+}
+
+std::string_view Arena::intern(std::string_view string)
+{
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = strings_.find(string);
+        if (it != strings_.end())
+        {
+                ++stats_.intern_hits;
+                return *it;
+        }
+        char * data = (char *)buffer_.allocate(string.size() + 1, 1);
+        memcpy(data, string.data(), string.size());
+        data[string.size()] = 0;
+        ++stats_.allocations;
+        stats_.bytes += string.size() + 1;
+        return *strings_.emplace(data, string.size()).first;
+}
+
+Arena::Stats Arena::stats() const
+{
+        std::lock_guard<std::mutex> lock(mutex_);
+        Stats stats = stats_;
+        stats.blocks = upstream_.blocks;
+        stats.block_bytes = upstream_.bytes;
+        stats.strings = strings_.size();
+        return stats;
+}
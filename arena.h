@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <span>
+#include <string_view>
+#include <type_traits>
+#include <unordered_set>
+
+// Monotonic memory for what a Process learns while parsing and resolving objects:
+// load zones, NEEDED and RUNPATH entries, interned library names and paths. Nothing
+// is freed before the Arena goes, which is one free per block it took. Objects a
+// Process unloads leave their metadata behind; interned names are shared, so
+// reloading the same library only costs its load zones again.
+//
+// Safe to use from the parse workers.
+class Arena : public std::pmr::memory_resource
+{
+public:
+        struct Stats
+        {
+                size_t allocations = 0;         // served by the arena
+                size_t bytes = 0;
+                size_t blocks = 0;              // taken from the heap
+                size_t block_bytes = 0;
+                size_t strings = 0;             // distinct interned strings
+                size_t intern_hits = 0;         // intern() calls that found their string
+        };
+
+        explicit Arena(size_t initial_size = 16 << 10);
+        Arena(const Arena &) = delete;
+        Arena & operator=(const Arena &) = delete;
+
+        template <typename T>
+        std::span<const T> copy(std::span<const T> items)
+        {
+                static_assert(std::is_trivially_destructible_v<T>);
+                if (items.empty()) return {};
+                T * data = (T *)allocate(items.size_bytes(), alignof(T));
+                std::uninitialized_copy(items.begin(), items.end(), data);
+                return std::span<const T>(data, items.size());
+        }
+
+        // The one copy of `string` in the arena, NUL terminated
+        std::string_view intern(std::string_view string);
+
+        Stats stats() const;
+
+private:
+        // Counts what the monotonic buffer takes from the heap
+        class Upstream : public std::pmr::memory_resource
+        {
+        public:
+                size_t blocks = 0;
+                size_t bytes = 0;
+
+        private:
+                void * do_allocate(size_t bytes, size_t alignment) override;
+                void do_deallocate(void * p, size_t bytes, size_t alignment) override;
+                bool do_is_equal(const std::pmr::memory_resource & other) const noexcept override
+                {
+                        return this == &other;
+                }
+        };
+
+        void * do_allocate(size_t bytes, size_t alignment) override;
+        void do_deallocate(void *, size_t, size_t) override
+        {
+        }
+        bool do_is_equal(const std::pmr::memory_resource & other) const noexcept override
+        {
+                return this == &other;
+        }
+
+        mutable std::mutex mutex_;
+        Upstream upstream_;
+        std::pmr::monotonic_buffer_resource buffer_;
+        std::pmr::unordered_set<std::string_view> strings_;
+        Stats stats_;
+};
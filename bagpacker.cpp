@@ -0,0 +1,156 @@
+#include "bagpacker.h"
+#include "log.h"
+#include "process.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <vector>
+
+struct Bagpacker::Handle
+{
+        int object = -1;
+        size_t references = 0;
+        // object then its dependencies, breadth first: the sym() search order
+        std::vector<int> scope;
+};
+
+Bagpacker::Bagpacker()
+        : Bagpacker(Options{})
+{
+}
+
+// Objects stay bound now: a lazily bound PLT slot would read the symbol table
+// while a concurrent open() grows it
+Bagpacker::Bagpacker(const Options & options)
+        : process_(std::make_unique<Process>())
+{
+        process_->load_mode_ = options.map_files ? ElfObject::LoadMode::FileBacked : ElfObject::LoadMode::Copy;
+        process_->lazy_binding_ = false;
+        process_->jobs_ = std::max(1, options.jobs);
+        process_->mapping_pool_ = options.reuse_mappings;
+}
+
+// Finalizers run as if every handle was closed
+Bagpacker::~Bagpacker()
+{
+        while (!handles_.empty())
+        {
+                close(handles_.begin()->second.get());
+        }
+}
+
+Bagpacker::Handle * Bagpacker::open(const char * path)
+{
+        Trace::Scope scope("open", path);
+        std::lock_guard<std::mutex> lock(mutex_);
+        size_t first = process_->objects_.size();
+        int object = process_->load_object_and_dependencies(path);
+        if (object < 0)
+        {
+                LOG_ERROR("Cannot load '%s'\n", path);
+                return nullptr;
+        }
+        if (process_->apply_relocations() < 0 || process_->adjust_permissions() < 0)
+        {
+                LOG_ERROR("Cannot relocate '%s'\n", path);
+                process_->discard_objects(first);
+                return nullptr;
+        }
+        process_->run_initializers(first);
+
+        std::unique_ptr<Handle> & handle = handles_[object];
+        if (!handle)
+        {
+                handle = std::make_unique<Handle>();
+                handle->object = object;
+                std::vector<bool> seen(process_->objects_.size(), false);
+                handle->scope.push_back(object);
+                seen[object] = true;
+                for (size_t k = 0; k < handle->scope.size(); ++k)
+                {
+                        for (int dep : process_->objects_[handle->scope[k]].needed)
+                        {
+                                if (!seen[dep])
+                                {
+                                        seen[dep] = true;
+                                        handle->scope.push_back(dep);
+                                }
+                        }
+                }
+        }
+        ++handle->references;
+        process_->retain_object(object);
+        return handle.get();
+}
+
+void * Bagpacker::sym(Handle * handle, const char * name)
+{
+        uint32_t hash = ElfFile::gnu_hash(name);
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (int index : handle->scope)
+        {
+                const ElfObject & obj = process_->objects_[index];
+                const elf64_sym * symbol = obj.elf_file.lookup(name, hash);
+                if (symbol != nullptr)
+                {
+                        return (void *)(obj.base() + symbol->st_value);
+                }
+        }
+        return nullptr;
+}
+
+// The last reference unloads the object and whatever it alone needed, the indices of
+// the survivors move
+int Bagpacker::close(Handle * handle)
+{
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = handles_.find(handle->object);
+        if (it == handles_.end() || it->second.get() != handle)
+        {
+                LOG_ERROR("Bagpacker::close: unknown handle %p\n", (void *)handle);
+                return -1;
+        }
+        int object = handle->object;
+        if (--handle->references == 0)
+        {
+                handles_.erase(it);
+        }
+
+        std::vector<int> remap;
+        int ret = process_->release_object(object, remap);
+        if (ret < 0 || remap.empty())
+        {
+                return ret;
+        }
+        std::unordered_map<int, std::unique_ptr<Handle>> moved;
+        for (auto & [index, survivor] : handles_)
+        {
+                survivor->object = remap[index];
+                for (int & member : survivor->scope)
+                {
+                        member = remap[member];
+                }
+                moved.emplace(survivor->object, std::move(survivor));
+        }
+        handles_ = std::move(moved);
+        return 0;
+}
+
+size_t Bagpacker::references(const Handle * handle) const
+{
+        std::lock_guard<std::mutex> lock(mutex_);
+        return handle->references;
+}
+
+Bagpacker::Stats Bagpacker::stats() const
+{
+        std::lock_guard<std::mutex> lock(mutex_);
+        const Process::Stats & process = process_->stats_;
+        Stats stats;
+        stats.objects = process_->objects_.size();
+        stats.unloaded = process.objects_unloaded;
+        stats.pool_requests = process.pool_requests;
+        stats.pool_hits = process.pool_hits;
+        stats.pool_hit_rate = process.pool_requests > 0 ? (double)process.pool_hits / process.pool_requests : 0.0;
+        return stats;
+}
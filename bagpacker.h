@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+class Process;
+
+// Embeddable loader, the libbagpacker API: dlopen/dlsym/dlclose over one Process.
+//
+// Every open() loads only what the Process does not hold yet, relocates and protects
+// it against everything already loaded, and never touches the objects mapped before.
+// Handles are reference counted: opening a loaded file returns its handle again, and
+// objects are unloaded once no handle and no other object needs them.
+// DT_INIT and DT_INIT_ARRAY run once relocated, dependencies first, DT_FINI_ARRAY and
+// DT_FINI before unmapping; both run under the lock, they must not call Bagpacker.
+// Only Process is hidden behind this header, so it can change freely.
+class Bagpacker
+{
+public:
+        struct Handle;
+
+        struct Options
+        {
+                bool map_files = false;         // ElfObject::LoadMode::FileBacked
+                int jobs = 1;                   // threads loading and relocating each open()
+                bool reuse_mappings = true;     // unloaded address ranges go to the MappingPool
+        };
+
+        struct Stats
+        {
+                size_t objects = 0;             // loaded right now
+                size_t unloaded = 0;
+                size_t pool_requests = 0;       // reservations asked to the MappingPool
+                size_t pool_hits = 0;
+                double pool_hit_rate = 0.0;
+        };
+
+        Bagpacker();
+        explicit Bagpacker(const Options & options);
+        ~Bagpacker();
+        Bagpacker(const Bagpacker &) = delete;
+        Bagpacker & operator=(const Bagpacker &) = delete;
+
+        // `path` and its dependencies, nullptr on failure (diagnostics go through log.h).
+        // Names without a slash are searched for like DT_NEEDED entries.
+        Handle * open(const char * path);
+
+        // Address of `name` as defined by the object of `handle` or, breadth first, by its
+        // dependencies; nullptr when none defines it
+        void * sym(Handle * handle, const char * name);
+
+        // Drops one reference. The last one finalizes and unloads the object, then every
+        // dependency no other object or handle holds; the handle is invalid from then on.
+        int close(Handle * handle);
+
+        // Open references of `handle`
+        size_t references(const Handle * handle) const;
+
+        Stats stats() const;
+
+private:
+        mutable std::mutex mutex_;
+        std::unique_ptr<Process> process_;
+        std::unordered_map<int, std::unique_ptr<Handle>> handles_;     // by object index
+};
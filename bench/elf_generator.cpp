@@ -0,0 +1,185 @@
+#include "elf_generator.h"
+
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Exported data objects and a table of relocated words, the executable's R_X86_64_64
+// are resolved by the linker into RELATIVE
+static void write_data(FILE * file, const std::string & prefix, const ElfShape & shape, const std::vector<size_t> & needed)
+{
+        size_t symbols = std::max<size_t>({shape.symbols, shape.glob_dat, 1});
+        fprintf(file, "\t.data\n\t.p2align 3\n");
+        for (size_t k = 0; k < symbols; ++k)
+        {
+                fprintf(file, "\t.globl %s_s%zu\n\t.type %s_s%zu, @object\n\t.size %s_s%zu, 8\n%s_s%zu:\t.quad %zu\n",
+                        prefix.c_str(), k, prefix.c_str(), k, prefix.c_str(), k, prefix.c_str(), k, k);
+        }
+        fprintf(file, "%s_table:\n", prefix.c_str());
+        for (size_t k = 0; k < shape.relative; ++k)
+        {
+                fprintf(file, "\t.quad %s_table + %zu\n", prefix.c_str(), (k * 8) % 4096);
+        }
+        for (size_t k = 0; k < shape.absolute; ++k)
+        {
+                fprintf(file, "\t.quad %s_s%zu\n", prefix.c_str(), k % symbols);
+        }
+        // One cross object reference per dependency, resolved through the global table
+        for (size_t dep : needed)
+        {
+                fprintf(file, "\t.quad l%zu_s0\n", dep);
+        }
+        if (shape.data_bytes > 0)
+        {
+                fprintf(file, "\t.zero %zu\n", shape.data_bytes);
+        }
+}
+
+int ElfGenerator::write_library(const std::filesystem::path & source, const ElfShape & shape, size_t index,
+        const std::vector<size_t> & needed)
+{
+        FILE * file = fopen(source.c_str(), "w");
+        if (file == nullptr)
+        {
+                printf("Cannot write '%s'\n", source.c_str());
+                return -1;
+        }
+        std::string prefix = "l" + std::to_string(index);
+        fprintf(file, "\t.text\n\t.globl %s_entry\n\t.type %s_entry, @function\n%s_entry:\n\tsubq $8, %%rsp\n",
+                prefix.c_str(), prefix.c_str(), prefix.c_str());
+        for (size_t k = 0; k < shape.glob_dat; ++k)
+        {
+                fprintf(file, "\tmovq %s_s%zu@GOTPCREL(%%rip), %%rax\n", prefix.c_str(), k);
+        }
+        for (size_t k = 0; k < shape.jump_slot; ++k)
+        {
+                fprintf(file, "\tcall %s_f%zu@PLT\n", prefix.c_str(), k);
+        }
+        for (size_t dep : needed)
+        {
+                fprintf(file, "\tcall l%zu_entry@PLT\n", dep);
+        }
+        fprintf(file, "\taddq $8, %%rsp\n\txorl %%eax, %%eax\n\tret\n");
+        for (size_t k = 0; k < shape.jump_slot; ++k)
+        {
+                fprintf(file, "\t.globl %s_f%zu\n\t.type %s_f%zu, @function\n%s_f%zu:\n\tret\n",
+                        prefix.c_str(), k, prefix.c_str(), k, prefix.c_str(), k);
+        }
+        if (shape.text_bytes > 0)
+        {
+                fprintf(file, "\t.fill %zu, 1, 0x90\n", shape.text_bytes);
+        }
+        write_data(file, prefix, shape, needed);
+        fclose(file);
+        return 0;
+}
+
+int ElfGenerator::write_executable(const std::filesystem::path & source, const ElfShape & shape,
+        const std::vector<size_t> & needed)
+{
+        FILE * file = fopen(source.c_str(), "w");
+        if (file == nullptr)
+        {
+                printf("Cannot write '%s'\n", source.c_str());
+                return -1;
+        }
+        fprintf(file, "\t.text\n\t.globl _start\n\t.type _start, @function\n_start:\n\tandq $-16, %%rsp\n");
+        for (size_t dep : needed)
+        {
+                fprintf(file, "\tcall l%zu_entry@PLT\n", dep);
+        }
+        fprintf(file, "\tmovl $60, %%eax\n\txorl %%edi, %%edi\n\tsyscall\n");
+        if (shape.text_bytes > 0)
+        {
+                fprintf(file, "\t.fill %zu, 1, 0x90\n", shape.text_bytes);
+        }
+        write_data(file, "exe", shape, needed);
+        fclose(file);
+        return 0;
+}
+
+// Library i needs libraries (i + 1) * fanout ... (i + 1) * fanout + fanout - 1: a complete
+// tree numbered breadth first, the executable being its root
+int ElfGenerator::generate(const std::filesystem::path & directory, const ElfShape & shape,
+        std::vector<std::filesystem::path> & files)
+{
+        size_t libraries = 0;
+        size_t level = 1;
+        for (size_t d = 0; d < shape.depth; ++d)
+        {
+                level *= shape.fanout;
+                libraries += level;
+        }
+        auto children = [&](size_t node) {
+                std::vector<size_t> needed;
+                for (size_t j = 0; j < shape.fanout && node * shape.fanout + j < libraries; ++j)
+                {
+                        needed.push_back(node * shape.fanout + j);
+                }
+                return needed;
+        };
+
+        std::filesystem::create_directories(directory);
+        files.assign(1, directory / "gen_program");
+        for (size_t i = 0; i < libraries; ++i)
+        {
+                files.push_back(directory / ("libgen" + std::to_string(i) + ".so"));
+        }
+
+        // Deepest first, a library links against the ones it needs
+        for (size_t i = libraries; i-- > 0;)
+        {
+                std::vector<size_t> needed = children(i + 1);
+                std::filesystem::path source = directory / ("gen" + std::to_string(i) + ".s");
+                if (write_library(source, shape, i, needed) < 0)
+                {
+                        return -1;
+                }
+                std::string command = "cc -shared -nostdlib -o " + files[i + 1].string() + " " + source.string()
+                        + " -L" + directory.string() + " -Wl,-rpath," + directory.string();
+                for (size_t dep : needed)
+                {
+                        command += " -lgen" + std::to_string(dep);
+                }
+                if (system(command.c_str()) != 0)
+                {
+                        printf("Cannot build '%s'\n", files[i + 1].c_str());
+                        return -1;
+                }
+        }
+
+        std::vector<size_t> needed = children(0);
+        std::filesystem::path source = directory / "gen_program.s";
+        if (write_executable(source, shape, needed) < 0)
+        {
+                return -1;
+        }
+        std::string command = "cc -fPIE -pie -nostdlib -Wl,-E -o " + files[0].string() + " " + source.string()
+                + " -L" + directory.string() + " -Wl,-rpath," + directory.string();
+        for (size_t dep : needed)
+        {
+                command += " -lgen" + std::to_string(dep);
+        }
+        if (system(command.c_str()) != 0)
+        {
+                printf("Cannot build '%s'\n", files[0].c_str());
+                return -1;
+        }
+        return 0;
+}
+
+std::vector<std::string> ElfGenerator::exported_names(const ElfShape & shape, size_t index)
+{
+        std::string prefix = "l" + std::to_string(index);
+        std::vector<std::string> names = {prefix + "_entry"};
+        size_t symbols = std::max<size_t>({shape.symbols, shape.glob_dat, 1});
+        for (size_t k = 0; k < symbols; ++k)
+        {
+                names.push_back(prefix + "_s" + std::to_string(k));
+        }
+        for (size_t k = 0; k < shape.jump_slot; ++k)
+        {
+                names.push_back(prefix + "_f" + std::to_string(k));
+        }
+        return names;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+// Writes assembly for a PIE executable and a tree of shared objects of a given shape
+// and builds them with `cc -nostdlib`. Every count is per object.
+struct ElfShape
+{
+        size_t symbols = 1000;          // exported data objects, at least glob_dat
+        size_t relative = 1000;         // R_X86_64_RELATIVE
+        size_t absolute = 1000;         // R_X86_64_64 against the object's own symbols
+        size_t glob_dat = 100;          // R_X86_64_GLOB_DAT, one GOT slot per symbol
+        size_t jump_slot = 100;         // R_X86_64_JUMP_SLOT, one PLT slot per function
+        size_t depth = 1;               // levels of libraries under the executable
+        size_t fanout = 1;              // DT_NEEDED entries of the executable and of every library but the deepest
+        size_t text_bytes = 0;          // padding in .text
+        size_t data_bytes = 0;          // padding in .data
+};
+
+class ElfGenerator
+{
+public:
+        // Fills `files` with the executable then the libraries, breadth first, -1 when
+        // something cannot be written or built
+        static int generate(const std::filesystem::path & directory, const ElfShape & shape,
+                std::vector<std::filesystem::path> & files);
+
+        // The exported names of library `index` (0 is the first library), for lookups
+        static std::vector<std::string> exported_names(const ElfShape & shape, size_t index);
+
+private:
+        static int write_library(const std::filesystem::path & source, const ElfShape & shape, size_t index,
+                const std::vector<size_t> & needed);
+        static int write_executable(const std::filesystem::path & source, const ElfShape & shape,
+                const std::vector<size_t> & needed);
+};
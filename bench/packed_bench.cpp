@@ -0,0 +1,187 @@
+// Raw vs compressed packed images: how long mapping each takes, cold and warm,
+// and the storage bandwidth below which compression pays for its decompression.
+//
+//   bagpacker --pack app.bp ./app && bagpacker --pack app.bpz --compress ./app
+//   packed_bench app.bp app.bpz [threads]
+#include "../packed_image.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+static double seconds_since(Clock::time_point start)
+{
+        return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+static void drop_page_cache(const char * path)
+{
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd >= 0)
+        {
+                posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+                close(fd);
+        }
+}
+
+// Map, fault in every readable page, unmap: the cost a run pays before the entry point
+static double time_map(const char * path, int threads, bool cold, uint64_t * stored_bytes)
+{
+        if (cold)
+        {
+                drop_page_cache(path);
+        }
+        PackedImage image;
+        auto start = Clock::now();
+        if (image.map(path, threads) < 0)
+        {
+                exit(2);
+        }
+        long page_size = sysconf(_SC_PAGESIZE);
+        volatile char sink = 0;
+        for (const auto & segment : image.segments)
+        {
+                if ((segment.prot & PROT_READ) == 0) continue;
+                for (uint64_t offset = 0; offset < segment.file_length; offset += page_size)
+                {
+                        sink = sink + *(const char *)(segment.address + offset);
+                }
+        }
+        double elapsed = seconds_since(start);
+        *stored_bytes = image.stored_bytes;
+        image.unmap();
+        return elapsed;
+}
+
+static double best_of(int runs, const char * path, int threads, bool cold, uint64_t * stored_bytes)
+{
+        double best = 1e9;
+        for (int i = 0; i < runs; ++i)
+        {
+                best = std::min(best, time_map(path, threads, cold, stored_bytes));
+        }
+        return best;
+}
+
+// Decompression alone, from memory into a scratch buffer
+static double time_decompression(const char * path, int threads, uint64_t * raw_bytes)
+{
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) < 0)
+        {
+                printf("Cannot open '%s'\n", path);
+                exit(2);
+        }
+        std::vector<char> file(st.st_size);
+        if (pread(fd, file.data(), file.size(), 0) != (ssize_t)file.size())
+        {
+                printf("Cannot read '%s'\n", path);
+                exit(2);
+        }
+        close(fd);
+
+        PackedImage::Header header;
+        memcpy(&header, file.data(), sizeof(header));
+        std::vector<PackedImage::Segment> segments(header.segment_count);
+        memcpy(segments.data(), file.data() + sizeof(header), segments.size() * sizeof(PackedImage::Segment));
+
+        uint64_t total = 0;
+        for (const auto & segment : segments)
+        {
+                if (segment.compression != PackedImage::NONE) total += segment.file_length;
+        }
+        std::vector<char> scratch(total);
+
+        std::vector<PackedImage::Block> blocks;
+        uint64_t offset = 0;
+        for (auto segment : segments)
+        {
+                if (segment.compression == PackedImage::NONE) continue;
+                segment.address = (uint64_t)scratch.data() + offset;
+                offset += segment.file_length;
+                PackedImage::split_blocks(file.data() + segment.file_offset, segment, blocks);
+        }
+
+        double best = 1e9;
+        for (int run = 0; run < 5; ++run)
+        {
+                auto start = Clock::now();
+                std::vector<std::thread> workers;
+                for (int t = 0; t < threads; ++t)
+                {
+                        workers.emplace_back([&, t] {
+                                for (size_t k = t; k < blocks.size(); k += threads)
+                                {
+                                        PackedImage::decompress_block(blocks[k]);
+                                }
+                        });
+                }
+                for (auto & worker : workers)
+                {
+                        worker.join();
+                }
+                best = std::min(best, seconds_since(start));
+        }
+        *raw_bytes = total;
+        return best;
+}
+
+int main(int argc, char** argv)
+{
+        if (argc < 3)
+        {
+                printf("Usage: %s <raw image> <compressed image> [threads]\n", argv[0]);
+                return 1;
+        }
+        const char * raw = argv[1];
+        const char * compressed = argv[2];
+        int threads = argc > 3 ? atoi(argv[3]) : std::max(1u, std::thread::hardware_concurrency());
+
+        uint64_t raw_stored = 0, compressed_stored = 0;
+        double raw_cold = best_of(3, raw, threads, true, &raw_stored);
+        double raw_warm = best_of(5, raw, threads, false, &raw_stored);
+        double compressed_cold = best_of(3, compressed, threads, true, &compressed_stored);
+        double compressed_warm = best_of(5, compressed, threads, false, &compressed_stored);
+
+        uint64_t decompressed = 0;
+        double decompression_1 = time_decompression(compressed, 1, &decompressed);
+        double decompression_n = time_decompression(compressed, threads, &decompressed);
+
+        printf("image sizes: raw %lu KiB, compressed %lu KiB (%.2fx)\n",
+                raw_stored >> 10, compressed_stored >> 10, (double)raw_stored / std::max<uint64_t>(compressed_stored, 1));
+        printf("map + touch      cold        warm\n");
+        printf("  raw         %8.2f ms %8.2f ms\n", raw_cold * 1e3, raw_warm * 1e3);
+        printf("  compressed  %8.2f ms %8.2f ms\n", compressed_cold * 1e3, compressed_warm * 1e3);
+        printf("decompression of %lu KiB: %.0f MB/s on 1 thread, %.0f MB/s on %d\n", decompressed >> 10,
+                decompressed / decompression_1 / 1e6, decompressed / decompression_n / 1e6, threads);
+
+        // Reading S fewer bytes at bandwidth B saves S / B, decompressing costs T:
+        // compression wins below B* = S / T
+        if (compressed_stored >= raw_stored || decompressed == 0)
+        {
+                printf("nothing was compressed, raw always wins\n");
+                return 0;
+        }
+        double saved = raw_stored - compressed_stored;
+        printf("crossover: compression wins below %.0f MB/s of storage bandwidth\n", saved / decompression_n / 1e6);
+        printf("  bandwidth      raw   compressed\n");
+        for (double bandwidth : {50e6, 200e6, 500e6, 2e9, 8e9})
+        {
+                double raw_time = raw_stored / bandwidth;
+                double compressed_time = compressed_stored / bandwidth + decompression_n;
+                printf("  %5.0f MB/s %8.2f ms %8.2f ms%s\n", bandwidth / 1e6, raw_time * 1e3, compressed_time * 1e3,
+                        compressed_time < raw_time ? "  <" : "");
+        }
+        return 0;
+}
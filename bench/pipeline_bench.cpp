@@ -0,0 +1,87 @@
+// Load and relocation time of a generated program with a library dependency tree,
+// phase after phase (serial and -j4) against the Pipeline. The files stay in the
+// page cache: this measures the overlap of parsing, mapping and relocating, see
+// prefetch_bench for cold loads. Needs `cc` to build the program.
+//
+//   g++ -std=c++20 -O2 -DNDEBUG -pthread bench/pipeline_bench.cpp bench/elf_generator.cpp $(ls *.cpp | grep -v main.cpp) -o pipeline_bench
+//   ./pipeline_bench [directory] [key=value...]
+#include "../log.h"
+#include "../pipeline.h"
+#include "../process.h"
+#include "elf_generator.h"
+
+#include <algorithm>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+static constexpr int RUNS = 20;
+
+static void run(const std::filesystem::path & program, int jobs, bool pipeline)
+{
+        std::vector<double> times;
+        for (int k = 0; k < RUNS; ++k)
+        {
+                Process process;
+                process.jobs_ = jobs;
+                auto start = Clock::now();
+                int ret = pipeline ? Pipeline(process).run(program)
+                        : process.load_object_and_dependencies(program) < 0 ? -1 : process.apply_relocations();
+                if (ret < 0)
+                {
+                        exit(2);
+                }
+                times.push_back(std::chrono::duration<double>(Clock::now() - start).count());
+        }
+        std::sort(times.begin(), times.end());
+        printf("%-8s jobs %d  %8.2f ms median  %8.2f ms min\n", pipeline ? "pipeline" : "phases", jobs,
+                times[RUNS / 2] * 1e3, times[0] * 1e3);
+}
+
+int main(int argc, char** argv)
+{
+        std::filesystem::path directory = std::filesystem::temp_directory_path() / "pipeline_bench";
+        ElfShape shape;
+        shape.depth = 3;
+        shape.fanout = 4;
+        shape.relative = 20000;
+        for (int i = 1; i < argc; ++i)
+        {
+                const char * eq = strchr(argv[i], '=');
+                if (eq == nullptr)
+                {
+                        directory = argv[i];
+                        continue;
+                }
+                std::string key(argv[i], eq - argv[i]);
+                size_t value = strtoull(eq + 1, nullptr, 0);
+                if (key == "symbols") shape.symbols = value;
+                else if (key == "relative") shape.relative = value;
+                else if (key == "depth") shape.depth = value;
+                else if (key == "fanout") shape.fanout = value;
+                else
+                {
+                        printf("Unknown shape key '%s'\n", key.c_str());
+                        return 1;
+                }
+        }
+        std::vector<std::filesystem::path> files;
+        if (ElfGenerator::generate(std::filesystem::absolute(directory), shape, files) < 0)
+        {
+                return 1;
+        }
+        Log::verbosity = Log::WARNING;
+
+        printf("Warm loads of %zu objects, %d runs\n", files.size(), RUNS);
+        run(files[0], 1, false);
+        run(files[0], 4, false);
+        for (int jobs : {1, 2, 4})
+        {
+                run(files[0], jobs, true);
+        }
+        return 0;
+}
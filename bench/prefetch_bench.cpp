@@ -0,0 +1,106 @@
+// Cold page cache loads of a generated program with a 39 library dependency tree,
+// 2 MiB of text and data each, with and without --prefetch. The files are evicted
+// with posix_fadvise(DONTNEED) before every load, which needs a filesystem with a
+// page cache (not tmpfs); point it at network storage to see the most of it. Needs
+// `cc` to build the program.
+//
+//   g++ -std=c++20 -O2 -DNDEBUG -pthread bench/prefetch_bench.cpp bench/elf_generator.cpp $(ls *.cpp | grep -v main.cpp) -o prefetch_bench
+//   ./prefetch_bench [directory]
+#include "../log.h"
+#include "../process.h"
+#include "elf_generator.h"
+
+#include <chrono>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+static constexpr int RUNS = 5;
+
+// Drops `files` from the page cache, returns the fraction of their pages still resident
+static double evict(const std::vector<std::filesystem::path> & files)
+{
+        const size_t page_size = sysconf(_SC_PAGE_SIZE);
+        size_t pages = 0;
+        size_t resident = 0;
+        for (const auto & file : files)
+        {
+                int fd = open(file.c_str(), O_RDONLY);
+                struct stat st;
+                if (fd < 0 || fstat(fd, &st) < 0)
+                {
+                        printf("Cannot open '%s'\n", file.c_str());
+                        exit(2);
+                }
+                posix_fadvise(fd, 0, st.st_size, POSIX_FADV_DONTNEED);
+
+                void * data = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+                std::vector<unsigned char> vec((st.st_size + page_size - 1) / page_size);
+                if (data != MAP_FAILED && mincore(data, st.st_size, vec.data()) == 0)
+                {
+                        for (unsigned char v : vec)
+                        {
+                                resident += v & 1;
+                        }
+                }
+                pages += vec.size();
+                if (data != MAP_FAILED) munmap(data, st.st_size);
+                close(fd);
+        }
+        return pages > 0 ? (double)resident / pages : 0.0;
+}
+
+static void run(const std::vector<std::filesystem::path> & files, int jobs, bool prefetch)
+{
+        double total = 0;
+        double resident = 0;
+        size_t prefetched = 0;
+        for (int k = 0; k < RUNS; ++k)
+        {
+                resident += evict(files);
+                Process process;
+                process.jobs_ = jobs;
+                process.prefetch_ = prefetch;
+                auto start = Clock::now();
+                if (process.load_object_and_dependencies(files[0]) < 0)
+                {
+                        exit(2);
+                }
+                total += std::chrono::duration<double>(Clock::now() - start).count();
+                prefetched = process.stats_.prefetched_files;
+        }
+        printf("jobs %d  prefetch %-3s  %8.2f ms/load  (%zu files prefetched, %.0f%% resident after eviction)\n",
+                jobs, prefetch ? "on" : "off", total * 1e3 / RUNS, prefetched, resident * 100 / RUNS);
+}
+
+int main(int argc, char** argv)
+{
+        std::filesystem::path directory = std::filesystem::absolute(argc > 1 ? argv[1] : std::filesystem::temp_directory_path() / "prefetch_bench");
+        ElfShape shape;
+        shape.depth = 3;
+        shape.fanout = 3;
+        shape.text_bytes = 2 << 20;
+        shape.data_bytes = 2 << 20;
+        std::vector<std::filesystem::path> files;
+        if (ElfGenerator::generate(directory, shape, files) < 0)
+        {
+                return 1;
+        }
+        // What the linker just wrote is dirty, DONTNEED only drops clean pages
+        sync();
+        Log::verbosity = Log::WARNING;
+
+        printf("Cold loads of %zu objects, mean of %d\n", files.size(), RUNS);
+        for (int jobs : {1, 4})
+        {
+                run(files, jobs, false);
+                run(files, jobs, true);
+        }
+        return 0;
+}
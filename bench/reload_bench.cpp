@@ -0,0 +1,106 @@
+// Plugin reload cycles through the libbagpacker API: open, call, close, with and
+// without the MappingPool. A generated plugin with 1 MiB of relocated data makes
+// page faults show up. Needs `cc` to assemble the plugin.
+//
+//   g++ -std=c++20 -O2 -DNDEBUG -pthread bench/reload_bench.cpp $(ls *.cpp | grep -v main.cpp) -o reload_bench
+#include "../bagpacker.h"
+
+#include <chrono>
+#include <filesystem>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <sys/resource.h>
+
+using Clock = std::chrono::steady_clock;
+
+static constexpr int CYCLES = 2000;
+static constexpr int DATA_WORDS = 131072;       // 1 MiB of pointers, one RELATIVE each
+
+static int generate_plugin(const std::filesystem::path & directory, std::filesystem::path & plugin)
+{
+        std::filesystem::path source = directory / "reload_plugin.s";
+        plugin = directory / "libreload_plugin.so";
+
+        std::error_code error;
+        std::filesystem::create_directories(directory, error);
+        FILE * file = fopen(source.c_str(), "w");
+        if (file == nullptr)
+        {
+                printf("Cannot write '%s'\n", source.c_str());
+                return -1;
+        }
+        fprintf(file, "\t.text\n\t.globl plugin_entry\n\t.type plugin_entry, @function\nplugin_entry:\n");
+        fprintf(file, "\tleaq ltable(%%rip), %%rax\n\tmovq 8(%%rax), %%rax\n\tret\n");
+        fprintf(file, "\t.data\n\t.p2align 3\nltable:\n");
+        for (int i = 0; i < DATA_WORDS; ++i)
+        {
+                fprintf(file, "\t.quad ltable + %d\n", (i * 8) % 4096);
+        }
+        fclose(file);
+
+        std::string command = "cc -shared -nostdlib -o " + plugin.string() + " " + source.string();
+        if (system(command.c_str()) != 0)
+        {
+                printf("Cannot assemble '%s'\n", source.c_str());
+                return -1;
+        }
+        return 0;
+}
+
+static long minor_faults()
+{
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        return usage.ru_minflt;
+}
+
+static void cycle(const std::filesystem::path & plugin, bool map_files, bool reuse_mappings)
+{
+        Bagpacker::Options options;
+        options.map_files = map_files;
+        options.reuse_mappings = reuse_mappings;
+        Bagpacker loader(options);
+
+        long faults = minor_faults();
+        auto start = Clock::now();
+        for (int k = 0; k < CYCLES; ++k)
+        {
+                Bagpacker::Handle * handle = loader.open(plugin.c_str());
+                if (handle == nullptr)
+                {
+                        exit(2);
+                }
+                auto entry = (uintptr_t (*)())loader.sym(handle, "plugin_entry");
+                if (entry == nullptr || entry() == 0)
+                {
+                        exit(3);
+                }
+                loader.close(handle);
+        }
+        double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        faults = minor_faults() - faults;
+
+        Bagpacker::Stats stats = loader.stats();
+        printf("%-12s pool %-3s  %8.1f us/cycle  %8.1f faults/cycle  hit rate %.2f\n",
+                map_files ? "file-backed" : "copy", reuse_mappings ? "on" : "off",
+                seconds * 1e6 / CYCLES, (double)faults / CYCLES, stats.pool_hit_rate);
+}
+
+int main(int argc, char** argv)
+{
+        std::filesystem::path directory = argc > 1 ? argv[1] : std::filesystem::temp_directory_path();
+        std::filesystem::path plugin;
+        if (generate_plugin(directory, plugin) < 0)
+        {
+                return 1;
+        }
+
+        printf("%d open/call/close cycles of a plugin with %d relocated words\n", CYCLES, DATA_WORDS);
+        for (bool map_files : {false, true})
+        {
+                cycle(plugin, map_files, false);
+                cycle(plugin, map_files, true);
+        }
+        return 0;
+}
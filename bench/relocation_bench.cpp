@@ -0,0 +1,116 @@
+// Relocation throughput on a generated library with 100k relocations, half
+// RELATIVE, half R_X86_64_64 against 1000 exported symbols, with logging off
+// and, when TRACE is compiled in, with every relocation printed as bagpacker
+// used to do. Needs `cc` to assemble the library.
+//
+//   g++ -std=c++20 -O2 -DNDEBUG -pthread bench/relocation_bench.cpp $(ls *.cpp | grep -v main.cpp) -o relocation_bench
+//   g++ -std=c++20 -O2 -DNDEBUG -DBAGPACKER_LOG_LEVEL=4 -pthread ... -o relocation_bench_trace
+#include "../log.h"
+#include "../process.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <unistd.h>
+
+using Clock = std::chrono::steady_clock;
+
+static constexpr int RELOCATIONS = 100000;
+static constexpr int SYMBOLS = 1000;
+
+static int generate_library(const std::filesystem::path & directory, std::filesystem::path & library)
+{
+        std::filesystem::path source = directory / "relocations.s";
+        library = directory / "librelocations.so";
+
+        std::error_code error;
+        std::filesystem::create_directories(directory, error);
+        FILE * file = fopen(source.c_str(), "w");
+        if (file == nullptr)
+        {
+                printf("Cannot write '%s'\n", source.c_str());
+                return -1;
+        }
+        fprintf(file, "\t.data\n");
+        for (int i = 0; i < SYMBOLS; ++i)
+        {
+                fprintf(file, "\t.globl sym%d\nsym%d:\t.quad 0\n", i, i);
+        }
+        fprintf(file, "table:\n");
+        for (int i = 0; i < RELOCATIONS; i += 2)
+        {
+                fprintf(file, "\t.quad sym%d\n\t.quad table + %d\n", i % SYMBOLS, i * 8);
+        }
+        fclose(file);
+
+        std::string command = "cc -shared -nostdlib -o " + library.string() + " " + source.string();
+        if (system(command.c_str()) != 0)
+        {
+                printf("Cannot assemble '%s'\n", source.c_str());
+                return -1;
+        }
+        return 0;
+}
+
+// Best wall time of apply_relocations over fresh loads of the library
+static double time_relocations(const std::filesystem::path & library, int runs, size_t & relocations)
+{
+        double best = 1e9;
+        for (int run = 0; run < runs; ++run)
+        {
+                Process process;
+                if (process.load_object_and_dependencies(library) < 0)
+                {
+                        exit(2);
+                }
+                relocations = process.objects_[0].elf_file.relocations().size();
+                auto start = Clock::now();
+                if (process.apply_relocations() < 0)
+                {
+                        exit(2);
+                }
+                best = std::min(best, std::chrono::duration<double>(Clock::now() - start).count());
+        }
+        return best;
+}
+
+int main(int argc, char** argv)
+{
+        std::filesystem::path directory = argc > 1 ? argv[1] : std::filesystem::temp_directory_path();
+        std::filesystem::path library;
+        if (generate_library(directory, library) < 0)
+        {
+                return 1;
+        }
+
+        size_t relocations = 0;
+        Log::verbosity = Log::WARNING;
+        double quiet = time_relocations(library, 10, relocations);
+        printf("%zu relocations, logging off:      %8.2f ms  %6.1f ns/relocation\n",
+                relocations, quiet * 1e3, quiet * 1e9 / relocations);
+
+        if (Log::COMPILED_LEVEL < Log::TRACE)
+        {
+                printf("TRACE is compiled out, rebuild with -DBAGPACKER_LOG_LEVEL=4 to time printing every relocation\n");
+                return 0;
+        }
+
+        // What printing every relocation costs, even when nobody reads it
+        fflush(stdout);
+        int saved_stdout = dup(STDOUT_FILENO);
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        Log::verbosity = Log::TRACE;
+        double traced = time_relocations(library, 3, relocations);
+        fflush(stdout);
+        dup2(saved_stdout, STDOUT_FILENO);
+        close(null);
+        close(saved_stdout);
+
+        printf("%zu relocations, traced to /dev/null: %8.2f ms  %6.1f ns/relocation (%.1fx)\n",
+                relocations, traced * 1e3, traced * 1e9 / relocations, traced / quiet);
+        return 0;
+}
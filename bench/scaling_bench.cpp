@@ -0,0 +1,215 @@
+// ElfFile::parse, ElfObject::load, symbol lookup and apply_relocations over
+// generated programs of growing size, see bench/elf_generator.h. One JSON object
+// per line and per scale, best of RUNS. Needs `cc` to build the programs.
+//
+//   g++ -std=c++20 -O2 -DNDEBUG -pthread bench/scaling_bench.cpp bench/elf_generator.cpp $(ls *.cpp | grep -v main.cpp) -o scaling_bench
+//   ./scaling_bench [directory] [symbols=N relative=N absolute=N glob_dat=N jump_slot=N depth=N fanout=N text_bytes=N data_bytes=N]
+//
+// With shape arguments only that shape is run, the others keep their ElfShape defaults.
+#include "../log.h"
+#include "../process.h"
+#include "elf_generator.h"
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+static constexpr int RUNS = 5;
+
+struct Scale
+{
+        std::string name;
+        ElfShape shape;
+};
+
+static std::vector<Scale> default_scales()
+{
+        std::vector<Scale> scales;
+        for (size_t n : {100, 1000, 10000, 100000})
+        {
+                ElfShape shape;
+                shape.symbols = n;
+                shape.relative = n;
+                shape.absolute = n;
+                shape.glob_dat = n / 10;
+                shape.jump_slot = n / 10;
+                scales.push_back({"entries_" + std::to_string(n), shape});
+        }
+        for (size_t fanout : {2, 4, 8})
+        {
+                ElfShape shape;
+                shape.depth = 2;
+                shape.fanout = fanout;
+                scales.push_back({"tree_2x" + std::to_string(fanout), shape});
+        }
+        ElfShape segments;
+        segments.text_bytes = 16 << 20;
+        segments.data_bytes = 16 << 20;
+        scales.push_back({"segments_16m", segments});
+        return scales;
+}
+
+static bool parse_shape(int argc, char** argv, ElfShape & shape)
+{
+        struct Field { const char * key; size_t ElfShape::* member; };
+        static const Field fields[] = {
+                {"symbols", &ElfShape::symbols}, {"relative", &ElfShape::relative}, {"absolute", &ElfShape::absolute},
+                {"glob_dat", &ElfShape::glob_dat}, {"jump_slot", &ElfShape::jump_slot}, {"depth", &ElfShape::depth},
+                {"fanout", &ElfShape::fanout}, {"text_bytes", &ElfShape::text_bytes}, {"data_bytes", &ElfShape::data_bytes},
+        };
+        bool custom = false;
+        for (int i = 2; i < argc; ++i)
+        {
+                const char * value = strchr(argv[i], '=');
+                auto field = std::find_if(std::begin(fields), std::end(fields), [&](const Field & f) {
+                        return value != nullptr && strncmp(argv[i], f.key, value - argv[i]) == 0 && f.key[value - argv[i]] == 0;
+                });
+                if (field == std::end(fields))
+                {
+                        printf("Unknown shape argument '%s'\n", argv[i]);
+                        exit(1);
+                }
+                shape.*(field->member) = strtoull(value + 1, nullptr, 0);
+                custom = true;
+        }
+        return custom;
+}
+
+template <typename F>
+static double best_of(F && run)
+{
+        double best = 1e9;
+        for (int k = 0; k < RUNS; ++k)
+        {
+                best = std::min(best, run());
+        }
+        return best;
+}
+
+static void measure(const std::filesystem::path & directory, const Scale & scale)
+{
+        std::vector<std::filesystem::path> files;
+        if (ElfGenerator::generate(directory / scale.name, scale.shape, files) < 0)
+        {
+                exit(2);
+        }
+
+        double parse = best_of([&] {
+                double seconds = 0;
+                Arena arena;
+                for (const auto & file : files)
+                {
+                        ElfFile elf_file;
+                        auto start = Clock::now();
+                        if (elf_file.load_elf_file(file.c_str()) < 0 || elf_file.parse(arena) < 0)
+                        {
+                                exit(2);
+                        }
+                        seconds += std::chrono::duration<double>(Clock::now() - start).count();
+                }
+                return seconds;
+        });
+
+        double load = best_of([&] {
+                double seconds = 0;
+                Arena arena;
+                for (const auto & file : files)
+                {
+                        ElfObject obj;
+                        if (obj.load_and_parse_elf_file(file, arena) < 0)
+                        {
+                                exit(2);
+                        }
+                        auto start = Clock::now();
+                        if (obj.load() < 0)
+                        {
+                                exit(2);
+                        }
+                        seconds += std::chrono::duration<double>(Clock::now() - start).count();
+                }
+                return seconds;
+        });
+
+        // Every exported name of every library, in an order the caches do not predict
+        std::vector<std::string> names;
+        for (size_t i = 0; i + 1 < files.size(); ++i)
+        {
+                std::vector<std::string> exported = ElfGenerator::exported_names(scale.shape, i);
+                names.insert(names.end(), exported.begin(), exported.end());
+        }
+        std::shuffle(names.begin(), names.end(), std::mt19937(42));
+
+        size_t relocations = 0;
+        size_t found = 0;
+        double process_load = 0;
+        double lookup = 1e9;
+        double relocate = 1e9;
+        for (int k = 0; k < RUNS; ++k)
+        {
+                Process process;
+                auto start = Clock::now();
+                if (process.load_object_and_dependencies(files[0]) < 0)
+                {
+                        exit(2);
+                }
+                double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+                process_load = k == 0 ? seconds : std::min(process_load, seconds);
+
+                found = 0;
+                start = Clock::now();
+                for (const auto & name : names)
+                {
+                        int definer = -1;
+                        found += process.lookup_symbol(name.c_str(), -1, definer) != nullptr;
+                }
+                lookup = std::min(lookup, std::chrono::duration<double>(Clock::now() - start).count());
+
+                relocations = 0;
+                for (const auto & obj : process.objects_)
+                {
+                        relocations += obj.elf_file.relocations().size() + obj.elf_file.plt_relocations().size();
+                }
+                start = Clock::now();
+                if (process.apply_relocations() < 0)
+                {
+                        exit(2);
+                }
+                relocate = std::min(relocate, std::chrono::duration<double>(Clock::now() - start).count());
+        }
+
+        const ElfShape & s = scale.shape;
+        printf("{\"scale\": \"%s\", \"symbols\": %zu, \"relative\": %zu, \"absolute\": %zu, \"glob_dat\": %zu, "
+                "\"jump_slot\": %zu, \"depth\": %zu, \"fanout\": %zu, \"text_bytes\": %zu, \"data_bytes\": %zu, "
+                "\"objects\": %zu, \"relocations\": %zu, \"parse_us\": %.1f, \"load_us\": %.1f, \"process_load_us\": %.1f, "
+                "\"lookups\": %zu, \"found\": %zu, \"lookup_ns\": %.1f, \"relocate_us\": %.1f, \"relocate_ns\": %.2f}\n",
+                scale.name.c_str(), s.symbols, s.relative, s.absolute, s.glob_dat, s.jump_slot, s.depth, s.fanout,
+                s.text_bytes, s.data_bytes, files.size(), relocations, parse * 1e6, load * 1e6, process_load * 1e6,
+                names.size(), found, names.empty() ? 0.0 : lookup * 1e9 / names.size(), relocate * 1e6,
+                relocations > 0 ? relocate * 1e9 / relocations : 0.0);
+        fflush(stdout);
+}
+
+int main(int argc, char** argv)
+{
+        std::filesystem::path directory = std::filesystem::absolute(argc > 1 ? argv[1] : std::filesystem::temp_directory_path() / "scaling_bench");
+        Log::verbosity = Log::WARNING;
+
+        Scale custom = {"custom", {}};
+        if (parse_shape(argc, argv, custom.shape))
+        {
+                measure(directory, custom);
+                return 0;
+        }
+        for (const Scale & scale : default_scales())
+        {
+                measure(directory, scale);
+        }
+        return 0;
+}
@@ -0,0 +1,169 @@
+// Launches per second of a generated program linked to a library with 20k
+// relocations: plain exec (kernel + ld.so), exec of bagpacker when its path is
+// given, and the zygote, which forks an already loaded and relocated Process.
+// Needs `cc` to build the program.
+//
+//   g++ -std=c++20 -O2 -DNDEBUG -pthread bench/zygote_bench.cpp $(ls *.cpp | grep -v main.cpp) -o zygote_bench
+//   ./zygote_bench [directory] [path to bagpacker]
+#include "../log.h"
+#include "../process.h"
+#include "../zygote.h"
+
+#include <chrono>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using Clock = std::chrono::steady_clock;
+
+extern char ** environ;
+
+static constexpr int LAUNCHES = 1000;
+static constexpr int RELOCATIONS = 20000;
+static constexpr int SYMBOLS = 500;
+static constexpr int SERVER_TIMEOUT = 10;      // seconds for the zygote to load and listen
+
+static int generate_program(const std::filesystem::path & directory, std::filesystem::path & program)
+{
+        std::filesystem::path library_source = directory / "zygote_lib.s";
+        std::filesystem::path program_source = directory / "zygote_program.c";
+        program = directory / "zygote_program";
+
+        std::error_code error;
+        std::filesystem::create_directories(directory, error);
+        FILE * file = fopen(library_source.c_str(), "w");
+        if (file == nullptr)
+        {
+                printf("Cannot write '%s'\n", library_source.c_str());
+                return -1;
+        }
+        fprintf(file, "\t.text\n\t.globl lib_value\n\t.type lib_value, @function\nlib_value:\n\tmovl $0, %%eax\n\tret\n\t.data\n");
+        for (int i = 0; i < SYMBOLS; ++i)
+        {
+                fprintf(file, "\t.globl sym%d\nsym%d:\t.quad 0\n", i, i);
+        }
+        for (int i = 0; i < RELOCATIONS; ++i)
+        {
+                fprintf(file, "\t.quad sym%d\n", i % SYMBOLS);
+        }
+        fclose(file);
+
+        file = fopen(program_source.c_str(), "w");
+        if (file == nullptr)
+        {
+                printf("Cannot write '%s'\n", program_source.c_str());
+                return -1;
+        }
+        fprintf(file, "extern int lib_value(void);\n"
+                "void _start(void) { __asm__ volatile(\"syscall\" :: \"a\"(60), \"D\"(lib_value())); }\n");
+        fclose(file);
+
+        std::string command = "cc -shared -nostdlib -o " + (directory / "libzygote_lib.so").string() + " " + library_source.string()
+                + " && cc -O1 -fPIE -pie -nostdlib -o " + program.string() + " " + program_source.string()
+                + " -L" + directory.string() + " -lzygote_lib -Wl,-rpath," + directory.string();
+        if (system(command.c_str()) != 0)
+        {
+                printf("Cannot build '%s'\n", program.c_str());
+                return -1;
+        }
+        return 0;
+}
+
+static double spawn_rate(const std::vector<std::string> & command)
+{
+        std::vector<char *> argv;
+        for (const auto & arg : command)
+        {
+                argv.push_back((char *)arg.c_str());
+        }
+        argv.push_back(nullptr);
+
+        auto start = Clock::now();
+        for (int k = 0; k < LAUNCHES; ++k)
+        {
+                pid_t pid = 0;
+                int status = 0;
+                if (posix_spawn(&pid, argv[0], nullptr, nullptr, argv.data(), environ) != 0 || waitpid(pid, &status, 0) < 0
+                        || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+                {
+                        printf("'%s' failed\n", argv[0]);
+                        exit(2);
+                }
+        }
+        return LAUNCHES / std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+static double zygote_rate(const std::filesystem::path & program, const std::filesystem::path & socket_path)
+{
+        std::filesystem::remove(socket_path);
+        fflush(stdout);
+        pid_t server = fork();
+        if (server == 0)
+        {
+                Process process;
+                if (process.load_object_and_dependencies(program) < 0 || process.apply_relocations() < 0
+                        || process.adjust_permissions() < 0)
+                {
+                        _exit(2);
+                }
+                _exit(Zygote::serve(process, socket_path) < 0 ? 2 : 0);
+        }
+        auto deadline = Clock::now() + std::chrono::seconds(SERVER_TIMEOUT);
+        while (access(socket_path.c_str(), F_OK) != 0)
+        {
+                int status = 0;
+                if (waitpid(server, &status, WNOHANG) == server)
+                {
+                        printf("zygote server exited before listening\n");
+                        exit(2);
+                }
+                if (Clock::now() > deadline)
+                {
+                        printf("zygote server not listening after %d s\n", SERVER_TIMEOUT);
+                        kill(server, SIGKILL);
+                        waitpid(server, nullptr, 0);
+                        exit(2);
+                }
+                usleep(1000);
+        }
+
+        auto start = Clock::now();
+        for (int k = 0; k < LAUNCHES; ++k)
+        {
+                int status = 0;
+                if (Zygote::launch(socket_path, {program.string()}, status) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+                {
+                        printf("zygote launch failed\n");
+                        kill(server, SIGTERM);
+                        exit(2);
+                }
+        }
+        double rate = LAUNCHES / std::chrono::duration<double>(Clock::now() - start).count();
+        kill(server, SIGTERM);
+        waitpid(server, nullptr, 0);
+        return rate;
+}
+
+int main(int argc, char** argv)
+{
+        std::filesystem::path directory = std::filesystem::absolute(argc > 1 ? argv[1] : std::filesystem::temp_directory_path());
+        std::filesystem::path program;
+        if (generate_program(directory, program) < 0)
+        {
+                return 1;
+        }
+        Log::verbosity = Log::WARNING;
+
+        printf("%d launches of a program whose library has %d relocations\n", LAUNCHES, RELOCATIONS);
+        printf("plain exec:      %8.0f launches/s\n", spawn_rate({program.string()}));
+        if (argc > 2)
+        {
+                printf("bagpacker exec:  %8.0f launches/s\n", spawn_rate({argv[2], "-q", program.string()}));
+        }
+        printf("zygote:          %8.0f launches/s\n", zygote_rate(program, directory / "zygote_bench.sock"));
+        return 0;
+}
@@ -3,3 +3,8 @@
 #include <cstdint>
 
 static constexpr uintptr_t BASE_ADDRESS = 0x400000;
+
+// Objects of a Process with a fixed layout are placed from here on, each one
+// aligned on FIXED_LAYOUT_ALIGN, so every run maps them at the same addresses
+static constexpr uintptr_t FIXED_LAYOUT_BASE = 0x200000000000;
+static constexpr uintptr_t FIXED_LAYOUT_ALIGN = 0x200000;
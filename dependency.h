@@ -1,10 +0,0 @@
-#pragma once
-
-#include "mapped_zone.h"
-
-struct Dependency
-{
-        uintptr_t offset; // strtab offset
-        char *name;
-        MappedZone base_zone;
-};
\ No newline at end of file
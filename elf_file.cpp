@@ -1,4 +1,5 @@
 #include "elf_file.h"
+#include "log.h"
 
 #include <algorithm>
 #include <cerrno>
@@ -18,16 +19,20 @@ ElfFile::~ElfFile()
                 int ret = munmap((void*)((uintptr_t)file_data_), size_);
                 if (ret < 0)
                 {
-                        std::cerr << "ElfFile munmap error" << strerror(errno) << '\n';
+                        LOG_ERROR("ElfFile munmap error %s\n", strerror(errno));
                 }
         }
+        if (fd_ >= 0)
+        {
+                close(fd_);
+        }
 }
 
 int ElfFile::load_elf_file(const char * path)
 {
         if (origin_path_ != nullptr)
         {
-                printf("Error: ElfFile already loaded\n");
+                LOG_ERROR("Error: ElfFile already loaded\n");
                 return -1;
         }
 
@@ -43,114 +48,131 @@ int ElfFile::load_elf_file(const char * path)
 
         while (file_data_ == MAP_FAILED)
         {
-                fprintf(stderr, "Memory allocation failed for '%s'(Process aborted): %s\n", path, strerror(errno));
+                LOG_ERROR("Memory allocation failed for '%s'(Process aborted): %s\n", path, strerror(errno));
                 exit(1);
         }
 
-        int ret = close(fd);
-        return ret;
+        fd_ = fd;
+        return 0;
 }
 
-int ElfFile::parse()
+int ElfFile::parse(Arena & arena)
 {
         if (file_data_ == nullptr) assert(false);
         int ret = -1;
 
-        ret = retrieve_dynamic_section_header();
-        if (ret == 1)
+        ret = retrieve_pt_load_zones(arena);
+        if (ret < 0)
         {
-                printf("No dynamic section\n");
+                LOG_ERROR("Could not retrieve pt load zones from '%s'\n", origin_path_);
+                return ret;
         }
 
-        ret = retrieve_pt_load_zones();
-        if (ret < 0)
+        ret = retrieve_dynamic();
+        if (ret == 1)
+        {
+                LOG_DEBUG("No dynamic section in '%s'\n", origin_path_);
+        }
+        else if (ret < 0)
         {
-                printf("Could not retrieve pt load zones from '%s'\n", origin_path_);
+                LOG_ERROR("Could not retrieve PT_DYNAMIC from '%s'\n", origin_path_);
                 return ret;
         }
 
-        ret = retrieve_sht_dynsym();
+        ret = retrieve_dt_strtab();
         if (ret < 0)
         {
-                printf("Could not retrieve sht_dynsym section header from '%s'\n", origin_path_);
+                LOG_ERROR("Could not retrieve dt strtab from '%s'\n", origin_path_);
                 return ret;
         }
 
-        ret = retrieve_dt_strtab();
+        ret = retrieve_hash_tables();
         if (ret < 0)
         {
-                printf("Could not retrieve dt strtab from '%s'\n", origin_path_);
+                LOG_ERROR("Could not retrieve symbol hash tables from '%s'\n", origin_path_);
                 return ret;
         }
 
         ret = retrieve_dyn_symbols();
         if (ret < 0)
         {
-                printf("Could not retrieve dynamic symbols from '%s'\n", origin_path_);
+                LOG_ERROR("Could not retrieve dynamic symbols from '%s'\n", origin_path_);
                 return ret;
         }
 
-
-        ret = retrieve_rpath();
+        ret = retrieve_rpath(arena);
         if (ret < 0)
         {
-                printf("Could not retrieve run path from '%s'\n", origin_path_);
+                LOG_ERROR("Could not retrieve run path from '%s'\n", origin_path_);
                 return ret;
         }
 
-        ret = retrieve_needed();
+        ret = retrieve_needed(arena);
         if (ret < 0)
         {
-                printf("Could not retrieve dynamic needed from '%s'\n", origin_path_);
+                LOG_ERROR("Could not retrieve dynamic needed from '%s'\n", origin_path_);
                 return ret;
         }
 
         ret = retrieve_relocation_entries();
         if (ret < 0)
         {
-                printf("Could not retrieve relocation entries from '%s'\n", origin_path_);
+                LOG_ERROR("Could not retrieve relocation entries from '%s'\n", origin_path_);
+                return ret;
+        }
+
+        ret = retrieve_initializers();
+        if (ret < 0)
+        {
+                LOG_ERROR("Could not retrieve initializers from '%s'\n", origin_path_);
                 return ret;
         }
         return ret;
 }
 
-int ElfFile::retrieve_pt_load_zones()
+int ElfFile::retrieve_pt_load_zones(Arena & arena)
 {
-        for (int i = 0; i < elf_header().e_phnum; ++i)
+        std::span<const elf64_phdr> headers(program_headers_table(), elf_header().e_phnum);
+        size_t count = std::count_if(headers.begin(), headers.end(), [](const elf64_phdr & hdr) { return hdr.p_type == PT_LOAD; });
+        LoadZone * zones = (LoadZone *)arena.allocate(count * sizeof(LoadZone), alignof(LoadZone));
+        size_t k = 0;
+        for (const auto & hdr : headers)
         {
-                const auto & hdr = program_headers_table()[i];
                 if (hdr.p_type == PT_LOAD)
                 {
                         Elf64_Word prot_flags = 0;
                         prot_flags |= ((hdr.p_flags & PF_R) ? PROT_READ : 0);
                         prot_flags |= ((hdr.p_flags & PF_W) ? PROT_WRITE : 0);
                         prot_flags |= ((hdr.p_flags & PF_X) ? PROT_EXEC : 0);
-                        load_zones_.emplace_back(LoadZone{prot_flags, hdr.p_vaddr, hdr.p_memsz});
+                        zones[k++] = LoadZone{prot_flags, hdr.p_vaddr, hdr.p_memsz, hdr.p_offset, hdr.p_filesz};
                 }
         }
+        load_zones_ = std::span<const LoadZone>(zones, count);
         return 0;
 }
 
 int ElfFile::retrieve_relocation_entries()
 {
-        if (dynamic_section_header_ == nullptr)
-        {
-                return 0;
-        }
-
-        int size = dynamic_section_header_->sh_size / dynamic_section_header_->sh_entsize;
-        const elf64_dyn* dyntab = (const elf64_dyn*)(file_data_ + dynamic_section_header_->sh_offset);
+        const elf64_dyn* dyntab = dynamic_.data();
+        int size = dynamic_.size();
 
 
-        const elf64_rela * rela_tab = nullptr;
-        Elf64_Xword relatab_size = -1;
+        Elf64_Addr rela_addr = 0;
+        Elf64_Xword relatab_size = 0;
         Elf64_Xword relatab_ent_size = -1;
+        Elf64_Addr jmprel_addr = 0;
+        Elf64_Xword jmprel_size = 0;
+        Elf64_Xword pltrel_type = DT_RELA;
+        Elf64_Addr relr_addr = 0;
+        Elf64_Xword relr_size = 0;
+        Elf64_Xword relr_ent_size = sizeof(uint64_t);
+        Elf64_Xword relative_count = 0;
         for (int i = 0; i < size; ++i)
         {
                 switch (dyntab[i].d_tag)
                 {
                         case DT_RELA:
-                                rela_tab = (const elf64_rela *)(file_data_ + dyntab[i].d_un.d_ptr);
+                                rela_addr = dyntab[i].d_un.d_ptr;
                                 break;
                         case DT_RELASZ:
                                 relatab_size = dyntab[i].d_un.d_val;
@@ -158,125 +180,435 @@ int ElfFile::retrieve_relocation_entries()
                         case DT_RELAENT:
                                 relatab_ent_size = dyntab[i].d_un.d_val;
                                 break;
+                        case DT_JMPREL:
+                                jmprel_addr = dyntab[i].d_un.d_ptr;
+                                break;
+                        case DT_PLTRELSZ:
+                                jmprel_size = dyntab[i].d_un.d_val;
+                                break;
+                        case DT_PLTREL:
+                                pltrel_type = dyntab[i].d_un.d_val;
+                                break;
+                        case DT_RELR:
+                                relr_addr = dyntab[i].d_un.d_ptr;
+                                break;
+                        case DT_RELRSZ:
+                                relr_size = dyntab[i].d_un.d_val;
+                                break;
+                        case DT_RELRENT:
+                                relr_ent_size = dyntab[i].d_un.d_val;
+                                break;
+                        case DT_RELACOUNT:
+                                relative_count = dyntab[i].d_un.d_val;
+                                break;
+                        case DT_PLTGOT:
+                                pltgot_ = dyntab[i].d_un.d_ptr;
+                                break;
+                        case DT_BIND_NOW:
+                                bind_now_ = true;
+                                break;
+                        case DT_TEXTREL:
+                                text_relocations_ = true;
+                                break;
+                        case DT_FLAGS:
+                                bind_now_ |= (dyntab[i].d_un.d_val & DF_BIND_NOW) != 0;
+                                text_relocations_ |= (dyntab[i].d_un.d_val & DF_TEXTREL) != 0;
+                                break;
+                        case DT_FLAGS_1:
+                                bind_now_ |= (dyntab[i].d_un.d_val & DF_1_NOW) != 0;
+                                break;
+                }
+        }
+
+        // Tables are found by address, they must lie in the file part of a PT_LOAD
+        const elf64_rela * rela_tab = rela_addr != 0 ? (const elf64_rela *)file_pointer(rela_addr, relatab_size) : nullptr;
+        const elf64_rela * jmprel_tab = jmprel_addr != 0 ? (const elf64_rela *)file_pointer(jmprel_addr, jmprel_size) : nullptr;
+        const uint64_t * relr_tab = relr_addr != 0 ? (const uint64_t *)file_pointer(relr_addr, relr_size) : nullptr;
+        if ((rela_addr != 0 && rela_tab == nullptr) || (jmprel_addr != 0 && jmprel_tab == nullptr) || (relr_addr != 0 && relr_tab == nullptr))
+        {
+                LOG_ERROR("A relocation table of '%s' is outside its loaded segments\n", origin_path_);
+                return -1;
+        }
+
+        if (rela_tab != nullptr)
+        {
+                if (relatab_ent_size != (Elf64_Xword)-1 && relatab_ent_size != sizeof(elf64_rela))
+                {
+                        LOG_ERROR("Unsupported DT_RELAENT %lu in '%s'\n", relatab_ent_size, origin_path_);
+                        return -1;
+                }
+                relocation_entries_ = std::span<const elf64_rela>(rela_tab, relatab_size / sizeof(elf64_rela));
+                // The RELATIVE entries DT_RELACOUNT announces come first, trusted only as far as they are
+                size_t limit = std::min<size_t>(relative_count, relocation_entries_.size());
+                while (relative_count_ < limit && ELF64_R_TYPE(rela_tab[relative_count_].r_info) == RELATIVE)
+                {
+                        ++relative_count_;
+                }
+        }
+
+        if (relr_tab != nullptr)
+        {
+                if (relr_ent_size != sizeof(uint64_t))
+                {
+                        LOG_ERROR("Unsupported DT_RELRENT %lu in '%s'\n", relr_ent_size, origin_path_);
+                        return -1;
+                }
+                relr_ = std::span<const uint64_t>(relr_tab, relr_size / sizeof(uint64_t));
+        }
+
+        if (jmprel_tab != nullptr)
+        {
+                if (pltrel_type != DT_RELA)
+                {
+                        LOG_ERROR("Unsupported DT_PLTREL %lu in '%s'\n", pltrel_type, origin_path_);
+                        return -1;
+                }
+                plt_relocation_entries_ = std::span<const elf64_rela>(jmprel_tab, jmprel_size / sizeof(elf64_rela));
+        }
+        return 0;
+}
+
+int ElfFile::retrieve_initializers()
+{
+        Elf64_Xword init_array_size = 0;
+        Elf64_Xword fini_array_size = 0;
+        for (const auto & dyn : dynamic_)
+        {
+                switch (dyn.d_tag)
+                {
+                        case DT_INIT:
+                                initializers_.init = dyn.d_un.d_ptr;
+                                break;
+                        case DT_FINI:
+                                initializers_.fini = dyn.d_un.d_ptr;
+                                break;
+                        case DT_INIT_ARRAY:
+                                initializers_.init_array = dyn.d_un.d_ptr;
+                                break;
+                        case DT_INIT_ARRAYSZ:
+                                init_array_size = dyn.d_un.d_val;
+                                break;
+                        case DT_FINI_ARRAY:
+                                initializers_.fini_array = dyn.d_un.d_ptr;
+                                break;
+                        case DT_FINI_ARRAYSZ:
+                                fini_array_size = dyn.d_un.d_val;
+                                break;
                 }
         }
 
-        if (rela_tab == nullptr) return 0;
-        for (int i = 0; i < relatab_size / relatab_ent_size; ++i)
+        // The arrays are .init_array and .fini_array, in the file part of a PT_LOAD
+        if ((initializers_.init_array != 0 && file_pointer(initializers_.init_array, init_array_size) == nullptr)
+                || (initializers_.fini_array != 0 && file_pointer(initializers_.fini_array, fini_array_size) == nullptr))
         {
-                relocation_entries_.emplace_back(&rela_tab[i]);
-        }        
+                LOG_ERROR("DT_INIT_ARRAY or DT_FINI_ARRAY of '%s' is outside its loaded segments\n", origin_path_);
+                return -1;
+        }
+        initializers_.init_array_count = initializers_.init_array != 0 ? init_array_size / sizeof(Elf64_Addr) : 0;
+        initializers_.fini_array_count = initializers_.fini_array != 0 ? fini_array_size / sizeof(Elf64_Addr) : 0;
         return 0;
 }
 
-int ElfFile::retrieve_sht_dynsym()
+// DT_SYMTAB has no size: the symbol count is the highest index a hash table reaches,
+// or, without one, what fits before DT_STRTAB where linkers put it
+int ElfFile::retrieve_dyn_symbols()
 {
-        if (dynamic_section_header_ == nullptr)
+        if (dynamic_.empty())
         {
                 return 0;
         }
 
-        const elf64_shdr* section_headers = section_headers_table();
-        for (int i = 0; i < elf_header().e_shnum; ++i)
+        Elf64_Addr symtab = 0;
+        Elf64_Addr strtab = 0;
+        for (const auto & dyn : dynamic_)
         {
-                if (section_headers[i].sh_type == SHT_DYNSYM)
+                if (dyn.d_tag == SYMTAB) symtab = dyn.d_un.d_ptr;
+                else if (dyn.d_tag == STRTAB) strtab = dyn.d_un.d_ptr;
+                else if (dyn.d_tag == SYMENT && dyn.d_un.d_val != sizeof(elf64_sym))
                 {
-                        sht_dynsym_ = &section_headers[i];
-                        return 0;
+                        LOG_ERROR("Unsupported DT_SYMENT %lu in '%s'\n", dyn.d_un.d_val, origin_path_);
+                        return -1;
+                }
+        }
+        if (symtab == 0)
+        {
+                return 0;
+        }
+
+        size_t count = 0;
+        // The GNU hash only bounds the table when it hashes at least one symbol: the
+        // undefined ones before symoffset are not counted by symoffset otherwise
+        uint32_t last = 0;
+        if (gnu_hash_table_.buckets != nullptr)
+        {
+                for (uint32_t k = 0; k < gnu_hash_table_.nbuckets; ++k)
+                {
+                        last = std::max(last, gnu_hash_table_.buckets[k]);
+                }
+        }
+        if (gnu_hash_table_.buckets != nullptr && last > 0 && last >= gnu_hash_table_.symoffset)
+        {
+                const GnuHashTable & table = gnu_hash_table_;
+                const char * end = file_data_ + size_;
+                const uint32_t * chain = table.chain + (last - table.symoffset);
+                while ((const char *)(chain + 1) <= end && (*chain & 1) == 0)
+                {
+                        ++chain;
+                }
+                if ((const char *)(chain + 1) > end)
+                {
+                        LOG_ERROR("DT_GNU_HASH chain runs past the end of '%s'\n", origin_path_);
+                        return -1;
                 }
+                count = table.symoffset + (chain - table.chain) + 1;
+        }
+        else if (sysv_hash_table_.buckets != nullptr)
+        {
+                count = sysv_hash_table_.nchain;
+        }
+        else if (strtab > symtab)
+        {
+                count = (strtab - symtab) / sizeof(elf64_sym);
+        }
+        else if (gnu_hash_table_.buckets != nullptr)
+        {
+                count = gnu_hash_table_.symoffset;
         }
 
-        return -1;      
+        dyn_sym_tab_ = (const elf64_sym*)file_pointer(symtab, count * sizeof(elf64_sym));
+        if (dyn_sym_tab_ == nullptr)
+        {
+                LOG_ERROR("Dynamic symbol table runs past the end of '%s'\n", origin_path_);
+                return -1;
+        }
+        dyn_symbols_ = std::span<const elf64_sym>(dyn_sym_tab_, count);
+        return 0;
 }
 
-int ElfFile::retrieve_dyn_symbols()
+int ElfFile::retrieve_hash_tables()
 {
-        if (dynamic_section_header_ == nullptr)
+        for (const auto & dyn : dynamic_)
         {
-                return 0;
+                if (dyn.d_tag == GNUHASH)
+                {
+                        const uint32_t * header = (const uint32_t *)file_pointer(dyn.d_un.d_ptr, 4 * sizeof(uint32_t));
+                        if (header == nullptr)
+                        {
+                                return -1;
+                        }
+                        gnu_hash_table_.nbuckets = header[0];
+                        gnu_hash_table_.symoffset = header[1];
+                        gnu_hash_table_.bloom_size = header[2];
+                        gnu_hash_table_.bloom_shift = header[3];
+                        gnu_hash_table_.bloom = (const uint64_t *)(header + 4);
+                        gnu_hash_table_.buckets = (const uint32_t *)(gnu_hash_table_.bloom + gnu_hash_table_.bloom_size);
+                        gnu_hash_table_.chain = gnu_hash_table_.buckets + gnu_hash_table_.nbuckets;
+                        if (gnu_hash_table_.nbuckets == 0 || gnu_hash_table_.bloom_size == 0
+                                || file_pointer(dyn.d_un.d_ptr, (const char *)gnu_hash_table_.chain - (const char *)header) == nullptr)
+                        {
+                                return -1;
+                        }
+                }
+                else if (dyn.d_tag == HASH)
+                {
+                        const uint32_t * header = (const uint32_t *)file_pointer(dyn.d_un.d_ptr, 2 * sizeof(uint32_t));
+                        if (header == nullptr)
+                        {
+                                return -1;
+                        }
+                        sysv_hash_table_.nbuckets = header[0];
+                        sysv_hash_table_.nchain = header[1];
+                        sysv_hash_table_.buckets = header + 2;
+                        sysv_hash_table_.chain = sysv_hash_table_.buckets + sysv_hash_table_.nbuckets;
+                        size_t words = 2 + (size_t)sysv_hash_table_.nbuckets + sysv_hash_table_.nchain;
+                        if (sysv_hash_table_.nbuckets == 0 || file_pointer(dyn.d_un.d_ptr, words * sizeof(uint32_t)) == nullptr)
+                        {
+                                return -1;
+                        }
+                }
         }
+        return 0;
+}
 
-        const elf64_sym* sym_runner = (const elf64_sym*)(file_data_ + sht_dynsym_->sh_offset);
-        for (int i = 0; i < sht_dynsym_->sh_size / sht_dynsym_->sh_entsize; ++i)
+const elf64_sym* ElfFile::lookup(const char * name, uint32_t hash) const
+{
+        if (dyn_sym_tab_ == nullptr)
         {
-                dyn_symbols_.push_back(&sym_runner[i]);
+                return nullptr;
         }
-        return 0;
+        if (gnu_hash_table_.buckets != nullptr)
+        {
+                return gnu_lookup(name, hash);
+        }
+        if (sysv_hash_table_.buckets != nullptr)
+        {
+                return sysv_lookup(name);
+        }
+        return linear_lookup(name);
 }
 
-int ElfFile::retrieve_dt_strtab()
+const elf64_sym* ElfFile::gnu_lookup(const char * name, uint32_t hash) const
 {
-        if (dynamic_section_header_ == nullptr)
+        const GnuHashTable & table = gnu_hash_table_;
+
+        // Bloom filter: two bits per symbol, most misses stop here
+        uint64_t word = table.bloom[(hash / 64) % table.bloom_size];
+        uint64_t mask = ((uint64_t)1 << (hash % 64)) | ((uint64_t)1 << ((hash >> table.bloom_shift) % 64));
+        if ((word & mask) != mask)
         {
-                return 0;
+                return nullptr;
         }
 
-        dt_strtab_ = file_data_ + (sht_dynsym_ + 1)->sh_offset;
-        return 0;
+        uint32_t index = table.buckets[hash % table.nbuckets];
+        if (index < table.symoffset)
+        {
+                return nullptr;
+        }
+
+        // Chain entries hold the hash with the low bit marking the end of the bucket
+        for (;; ++index)
+        {
+                uint32_t chain_hash = table.chain[index - table.symoffset];
+                if ((hash | 1) == (chain_hash | 1) && defines(dyn_sym_tab_[index], name))
+                {
+                        return &dyn_sym_tab_[index];
+                }
+                if (chain_hash & 1) break;
+        }
+        return nullptr;
+}
 
-        return -1;      
+const elf64_sym* ElfFile::sysv_lookup(const char * name) const
+{
+        const SysvHashTable & table = sysv_hash_table_;
+        uint32_t hash = sysv_hash(name);
+        for (uint32_t index = table.buckets[hash % table.nbuckets]; index != STN_UNDEF; index = table.chain[index])
+        {
+                if (defines(dyn_sym_tab_[index], name))
+                {
+                        return &dyn_sym_tab_[index];
+                }
+        }
+        return nullptr;
 }
 
-int ElfFile::retrieve_dynamic_section_header()
+const elf64_sym* ElfFile::linear_lookup(const char * name) const
 {
-        const elf64_shdr* section_headers = section_headers_table();
-        for (int i = 0; i < elf_header().e_shnum; ++i)
+        for (const elf64_sym & sym : dyn_symbols_)
         {
-                if (section_headers[i].sh_type == SHT_DYNAMIC)
+                if (defines(sym, name))
                 {
-                        dynamic_section_header_ = &section_headers[i];
-                        return 0;
+                        return &sym;
                 }
         }
-        return 1;
+        return nullptr;
 }
 
-int ElfFile::retrieve_rpath()
+int ElfFile::retrieve_dt_strtab()
 {
-        if (dynamic_section_header_ == nullptr)
+        Elf64_Addr strtab = 0;
+        Elf64_Xword strsz = 0;
+        for (const auto & dyn : dynamic_)
+        {
+                if (dyn.d_tag == STRTAB) strtab = dyn.d_un.d_ptr;
+                else if (dyn.d_tag == STRSZ) strsz = dyn.d_un.d_val;
+        }
+        if (strtab == 0)
         {
+                return dynamic_.empty() ? 0 : -1;
+        }
+        dt_strtab_ = file_pointer(strtab, strsz);
+        dt_strsz_ = dt_strtab_ != nullptr ? strsz : 0;
+        return dt_strtab_ != nullptr ? 0 : -1;
+}
+
+// PT_DYNAMIC up to DT_NULL, 1 when the file has none
+int ElfFile::retrieve_dynamic()
+{
+        for (int i = 0; i < elf_header().e_phnum; ++i)
+        {
+                const auto & hdr = program_headers_table()[i];
+                if (hdr.p_type != PT_DYNAMIC) continue;
+
+                if (hdr.p_offset > (size_t)size_ || hdr.p_filesz > (size_t)size_ - hdr.p_offset)
+                {
+                        return -1;
+                }
+                std::span<const elf64_dyn> table((const elf64_dyn*)(file_data_ + hdr.p_offset), hdr.p_filesz / sizeof(elf64_dyn));
+                auto end = std::find_if(table.begin(), table.end(), [](const elf64_dyn & dyn) { return dyn.d_tag == 0; });
+                dynamic_ = table.first(end - table.begin());
                 return 0;
         }
+        return 1;
+}
 
-        int size = dynamic_section_header_->sh_size / dynamic_section_header_->sh_entsize;
-        const elf64_dyn* dyntab = (const elf64_dyn*)(file_data_ + dynamic_section_header_->sh_offset);
+const char * ElfFile::file_pointer(Elf64_Addr vaddr, size_t size) const
+{
+        for (const auto & zone : load_zones_)
+        {
+                if (vaddr >= zone.base && vaddr - zone.base < zone.file_length && size <= zone.file_length - (vaddr - zone.base))
+                {
+                        size_t offset = zone.offset + (vaddr - zone.base);
+                        return offset + size <= (size_t)size_ ? file_data_ + offset : nullptr;
+                }
+        }
+        return nullptr;
+}
+
+int ElfFile::retrieve_rpath(Arena & arena)
+{
+        const elf64_dyn* dyntab = dynamic_.data();
+        int size = dynamic_.size();
         for (int i = 0; i < size; ++i)
         {
                 if (dyntab[i].d_tag == RUNPATH)
                 {
-                        std::string rpath = dt_strtab_ + dyntab[i].d_un.d_ptr;
-                        int start = 0;
-                        for (int j = 0; j < rpath.length(); ++j)
+                        const char * string = dt_string(dyntab[i].d_un.d_val);
+                        if (string == nullptr)
                         {
-                                if (rpath[j] == ':')
-                                {
-                                        run_paths_.emplace_back(rpath.substr(start, j - start));
-                                        start = j + 1;
-                                }
+                                LOG_ERROR("DT_RUNPATH offset %lu outside DT_STRSZ %lu in '%s'\n",
+                                        dyntab[i].d_un.d_val, dt_strsz_, origin_path_);
+                                return -1;
                         }
-                        run_paths_.emplace_back(rpath.substr(start, rpath.length() - start));
+                        std::string_view rpath = string;
+                        size_t count = std::count(rpath.begin(), rpath.end(), ':') + 1;
+                        auto * paths = (std::string_view *)arena.allocate(count * sizeof(std::string_view), alignof(std::string_view));
+                        size_t start = 0;
+                        for (size_t k = 0; k < count; ++k)
+                        {
+                                size_t end = std::min(rpath.find(':', start), rpath.size());
+                                paths[k] = arena.intern(rpath.substr(start, end - start));
+                                start = end + 1;
+                        }
+                        run_paths_ = std::span<const std::string_view>(paths, count);
                         return 0;
                 }
         }
         return 1;
 }
 
-int ElfFile::retrieve_needed()
+int ElfFile::retrieve_needed(Arena & arena)
 {
-        if (dynamic_section_header_ == nullptr)
-        {
-                return 0;
-        }
-
-        int size = dynamic_section_header_->sh_size / dynamic_section_header_->sh_entsize;
-        const elf64_dyn* dyntab = (const elf64_dyn*)(file_data_ + dynamic_section_header_->sh_offset);
+        const elf64_dyn* dyntab = dynamic_.data();
+        int size = dynamic_.size();
+        size_t count = std::count_if(dyntab, dyntab + size, [](const elf64_dyn & dyn) { return dyn.d_tag == NEEDED; });
+        auto * names = (std::string_view *)arena.allocate(count * sizeof(std::string_view), alignof(std::string_view));
+        size_t k = 0;
         for (int i = 0; i < size; ++i)
         {
                 if (dyntab[i].d_tag == NEEDED)
                 {
-                        needed_.emplace_back(dt_strtab_ + dyntab[i].d_un.d_ptr);
+                        const char * name = dt_string(dyntab[i].d_un.d_val);
+                        if (name == nullptr)
+                        {
+                                LOG_ERROR("DT_NEEDED offset %lu outside DT_STRSZ %lu in '%s'\n",
+                                        dyntab[i].d_un.d_val, dt_strsz_, origin_path_);
+                                return -1;
+                        }
+                        names[k++] = arena.intern(name);
                 }
         }
+        needed_ = std::span<const std::string_view>(names, count);
         return 0;
 }
 
@@ -290,7 +622,7 @@ std::pair<uintptr_t, uintptr_t> ElfFile::get_pt_load_convex_hull()
         {
                 if (program_headers_table()[i].p_type == PT_LOAD)
                 {
-                        if (low == -1)
+                        if (low == (uintptr_t)-1)
                         {
                                 low = program_headers_table()[i].p_vaddr;
                         }
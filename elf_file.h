@@ -1,10 +1,13 @@
 #pragma once
 
+#include "arena.h"
 #include "elf_structures.h"
 #include <cassert>
 #include <filesystem>
+#include <span>
 #include <stdio.h>
 #include <string>
+#include <string.h>
 #include <utility>
 #include <vector>
 
@@ -17,13 +20,48 @@ public:
                 Elf64_Word flags = 0;
                 Elf64_Addr base = 0;
                 Elf64_Xword length = 0;
+                Elf64_Off offset = 0;           // p_offset in the file
+                Elf64_Xword file_length = 0;    // p_filesz, the rest is .bss
         };
 
-        const std::vector<LoadZone>& load_zones() const noexcept
+        std::span<const LoadZone> load_zones() const noexcept
         {
                 return load_zones_;
         }
 
+        // DT_GNU_HASH section, see https://flapenguin.me/elf-dt-gnu-hash
+        struct GnuHashTable
+        {
+                uint32_t nbuckets = 0;
+                uint32_t symoffset = 0;
+                uint32_t bloom_size = 0;
+                uint32_t bloom_shift = 0;
+                const uint64_t * bloom = nullptr;
+                const uint32_t * buckets = nullptr;
+                const uint32_t * chain = nullptr;
+        };
+
+        // DT_HASH section
+        struct SysvHashTable
+        {
+                uint32_t nbuckets = 0;
+                uint32_t nchain = 0;
+                const uint32_t * buckets = nullptr;
+                const uint32_t * chain = nullptr;
+        };
+
+        // DT_INIT, DT_FINI and the DT_INIT_ARRAY and DT_FINI_ARRAY tables as vaddrs, 0 when
+        // absent. The arrays are read from memory once relocated.
+        struct Initializers
+        {
+                Elf64_Addr init = 0;
+                Elf64_Addr fini = 0;
+                Elf64_Addr init_array = 0;
+                size_t init_array_count = 0;
+                Elf64_Addr fini_array = 0;
+                size_t fini_array_count = 0;
+        };
+
         ElfFile(const ElfFile &) = delete;
         ElfFile & operator=(const ElfFile & rhs) = delete; 
 
@@ -35,29 +73,51 @@ public:
         ElfFile & operator=(ElfFile && rhs) 
         {
                 file_data_ = rhs.file_data_;
-                dynamic_section_header_ = rhs.dynamic_section_header_;
-                dynamic_str_tab_ = rhs.dynamic_str_tab_;
-                dynamic_sym_tab_ = rhs.dynamic_sym_tab_;
+                fd_ = rhs.fd_;
+                dynamic_ = rhs.dynamic_;
                 dt_strtab_ = rhs.dt_strtab_;
+                dt_strsz_ = rhs.dt_strsz_;
+                dyn_sym_tab_ = rhs.dyn_sym_tab_;
+                gnu_hash_table_ = rhs.gnu_hash_table_;
+                sysv_hash_table_ = rhs.sysv_hash_table_;
                 size_ = rhs.size_;
-                run_paths_ = std::move(rhs.run_paths_);
-                needed_ = std::move(rhs.needed_);
-                load_zones_ = std::move(rhs.load_zones_);
-                relocation_entries_ = std::move(rhs.relocation_entries_);
-                dyn_symbols_ = std::move(rhs.dyn_symbols_);
+                run_paths_ = rhs.run_paths_;
+                needed_ = rhs.needed_;
+                load_zones_ = rhs.load_zones_;
+                relocation_entries_ = rhs.relocation_entries_;
+                plt_relocation_entries_ = rhs.plt_relocation_entries_;
+                relative_count_ = rhs.relative_count_;
+                relr_ = rhs.relr_;
+                pltgot_ = rhs.pltgot_;
+                bind_now_ = rhs.bind_now_;
+                text_relocations_ = rhs.text_relocations_;
+                initializers_ = rhs.initializers_;
+                dyn_symbols_ = rhs.dyn_symbols_;
 
                 rhs.file_data_ = nullptr;
-                rhs.dynamic_section_header_ = nullptr;
-                rhs.dynamic_str_tab_ = nullptr;
-                rhs.dynamic_sym_tab_ = nullptr;
+                rhs.fd_ = -1;
+                rhs.dynamic_ = {};
                 rhs.dt_strtab_ = nullptr;
+                rhs.dt_strsz_ = 0;
+                rhs.dyn_sym_tab_ = nullptr;
+                rhs.gnu_hash_table_ = {};
+                rhs.sysv_hash_table_ = {};
+                rhs.relocation_entries_ = {};
+                rhs.plt_relocation_entries_ = {};
+                rhs.relr_ = {};
+                rhs.initializers_ = {};
+                rhs.dyn_symbols_ = {};
+                rhs.run_paths_ = {};
+                rhs.needed_ = {};
+                rhs.load_zones_ = {};
                 return *this;
         }
 
         ~ElfFile();
 
         int load_elf_file(const char * path);
-        int parse();
+        // Load zones, NEEDED and RUNPATH entries live in `arena`, which must outlive the ElfFile
+        int parse(Arena & arena);
 
         const elf64_hdr &elf_header()
         {
@@ -68,33 +128,87 @@ public:
         {
                 return (const elf64_phdr*)(file_data_ + elf_header().e_phoff);
         }
-        const elf64_shdr *section_headers_table()
-        {
-                return (const elf64_shdr*)(file_data_ + elf_header().e_shoff);
-        }  
 
-        const std::vector<std::filesystem::path> &run_paths()
+        std::span<const std::string_view> run_paths() const noexcept
         {
                 return run_paths_;
         }
 
         std::pair<uintptr_t, uintptr_t> get_pt_load_convex_hull();
 
-        const std::vector<std::filesystem::path> & get_dependencies() const noexcept
+        std::span<const std::string_view> get_dependencies() const noexcept
         {
                 return needed_;
         }
 
-        const std::vector<const elf64_rela*>& relocations() const noexcept
+        // DT_RELA, a view into the file data
+        std::span<const elf64_rela> relocations() const noexcept
         {
                 return relocation_entries_;
         }
 
-        const char *file_data()
+        // Leading entries of relocations() the kernels of relative_relocations.h apply, DT_RELACOUNT
+        size_t relative_count() const noexcept
+        {
+                return relative_count_;
+        }
+
+        std::span<const elf64_rela> relative_relocations() const noexcept
+        {
+                return relocation_entries_.first(relative_count_);
+        }
+
+        // DT_RELR, packed RELATIVE relocations
+        std::span<const uint64_t> relr() const noexcept
+        {
+                return relr_;
+        }
+
+        // DT_JMPREL entries, indexed by the relocation index the PLT stubs push
+        std::span<const elf64_rela> plt_relocations() const noexcept
+        {
+                return plt_relocation_entries_;
+        }
+
+        // DT_PLTGOT, 0 when the file has no PLT
+        Elf64_Addr pltgot() const noexcept
+        {
+                return pltgot_;
+        }
+
+        // DT_TEXTREL or DF_TEXTREL: relocations also patch non-writable segments
+        bool text_relocations() const noexcept
+        {
+                return text_relocations_;
+        }
+
+        // DT_BIND_NOW, DF_BIND_NOW or DF_1_NOW: the file asks for eager binding
+        bool bind_now() const noexcept
+        {
+                return bind_now_;
+        }
+
+        const Initializers & initializers() const noexcept
+        {
+                return initializers_;
+        }
+
+        const char *file_data() const
         {
                 return file_data_;
         }
 
+        size_t size() const noexcept
+        {
+                return size_;
+        }
+
+        // The descriptor is kept open so segments can be mapped straight from the file
+        int fd() const noexcept
+        {
+                return fd_;
+        }
+
         uintptr_t entry_point()
         {
                 return elf_header().e_entry;
@@ -102,49 +216,114 @@ public:
 
         int retrieve_dyn_symbols();
 
-        Elf64_Addr symbol_value_from_index(size_t sym_index)
+        int symbol_value_from_index(size_t sym_index, Elf64_Addr & value) const
         {
-                return dyn_symbols_[sym_index]->st_value;
+                if (sym_index >= dyn_symbols_.size())
+                {
+                        return -1;
+                }
+                value = dyn_symbols_[sym_index].st_value;
+                return 0;
         }
 
-        const std::vector<const elf64_sym*>& dyn_symbols()
+        std::span<const elf64_sym> dyn_symbols() const noexcept
         {
                 return dyn_symbols_;
         }
 
-        const char* dt_name_from_index(Elf64_Word index)
+        const char* dt_name_from_index(Elf64_Word index) const
         {
                 return dt_strtab_ + index;
         }
 
-private:
-        const char* sh_strtab()
+        // The string at `offset` in DT_STRTAB, nullptr when it does not end within DT_STRSZ
+        const char* dt_string(Elf64_Xword offset) const
         {
-                return file_data_ + program_headers_table()[elf_header().e_shstrndx].p_offset;
+                if (dt_strtab_ == nullptr || offset >= dt_strsz_
+                        || memchr(dt_strtab_ + offset, '\0', dt_strsz_ - offset) == nullptr)
+                {
+                        return nullptr;
+                }
+                return dt_strtab_ + offset;
         }
 
-        int retrieve_pt_load_zones();
-        int retrieve_rpath();
-        int retrieve_dynamic_section_header();
+        static uint32_t gnu_hash(const char * name)
+        {
+                uint32_t h = 5381;
+                for (const unsigned char * c = (const unsigned char*)name; *c; ++c)
+                {
+                        h = (h << 5) + h + *c;
+                }
+                return h;
+        }
+
+        static uint32_t sysv_hash(const char * name)
+        {
+                uint32_t h = 0;
+                for (const unsigned char * c = (const unsigned char*)name; *c; ++c)
+                {
+                        h = (h << 4) + *c;
+                        uint32_t g = h & 0xf0000000;
+                        if (g) h ^= g >> 24;
+                        h &= ~g;
+                }
+                return h;
+        }
+
+        // Returns the symbol defined by this file under `name`, or nullptr.
+        // `hash` is the gnu_hash of `name`, DT_HASH files compute their own.
+        const elf64_sym* lookup(const char * name, uint32_t hash) const;
+
+private:
+        int retrieve_pt_load_zones(Arena & arena);
+        int retrieve_rpath(Arena & arena);
+        int retrieve_dynamic();
         int retrieve_dt_strtab();
-        int retrieve_sht_dynsym();
-        int retrieve_needed();
+        int retrieve_needed(Arena & arena);
         int retrieve_relocation_entries();
+        int retrieve_hash_tables();
+        int retrieve_initializers();
+
+        // Where the bytes at `vaddr` are in the file, nullptr unless `size` of them are in
+        // the file part of one PT_LOAD
+        const char * file_pointer(Elf64_Addr vaddr, size_t size = 0) const;
+
+        const elf64_sym* gnu_lookup(const char * name, uint32_t hash) const;
+        const elf64_sym* sysv_lookup(const char * name) const;
+        const elf64_sym* linear_lookup(const char * name) const;
+
+        bool defines(const elf64_sym & sym, const char * name) const
+        {
+                return sym.st_shndx != SHN_UNDEF
+                        && ELF64_ST_BIND(sym.st_info) != STB_LOCAL
+                        && strcmp(dt_strtab_ + sym.st_name, name) == 0;
+        }
 
 private:
         const char * origin_path_ = nullptr;
         char * file_data_ = nullptr;
+        int fd_ = -1;
         int size_ = 0;
 
-        const elf64_shdr* dynamic_section_header_ = nullptr;
-        const elf64_shdr* dynamic_str_tab_ = nullptr;
-        const elf64_shdr* dynamic_sym_tab_ = nullptr;
+        // Everything below is found from PT_DYNAMIC, section headers are never read
+        std::span<const elf64_dyn> dynamic_;
         const char * dt_strtab_ = nullptr;
-        const elf64_shdr * sht_dynsym_ = nullptr;
+        Elf64_Xword dt_strsz_ = 0;
+        const elf64_sym * dyn_sym_tab_ = nullptr;
+
+        GnuHashTable gnu_hash_table_;
+        SysvHashTable sysv_hash_table_;
 
-        std::vector<const elf64_rela*> relocation_entries_;
-        std::vector<const elf64_sym*> dyn_symbols_;
-        std::vector<LoadZone> load_zones_;
-        std::vector<std::filesystem::path> run_paths_;
-        std::vector<std::filesystem::path> needed_;
+        std::span<const elf64_rela> relocation_entries_;
+        std::span<const elf64_rela> plt_relocation_entries_;
+        size_t relative_count_ = 0;
+        std::span<const uint64_t> relr_;
+        Elf64_Addr pltgot_ = 0;
+        bool bind_now_ = false;
+        bool text_relocations_ = false;
+        Initializers initializers_;
+        std::span<const elf64_sym> dyn_symbols_;
+        std::span<const LoadZone> load_zones_;
+        std::span<const std::string_view> run_paths_;
+        std::span<const std::string_view> needed_;
 };
\ No newline at end of file
@@ -1,23 +1,149 @@
 #include "elf_object.h"
+#include "log.h"
 
+#include <algorithm>
 #include <filesystem>
+#include <sys/mman.h>
+#include <unistd.h>
 
-int ElfObject::load_and_parse_elf_file(std::filesystem::path path)
+int ElfObject::load_and_parse_elf_file(std::filesystem::path path, Arena & arena)
 {
+        this->path = path;
         int ret = elf_file.load_elf_file(path.c_str());
         if (ret < 0)
         {
-                printf("Error loading elf_file for '%s'\n", path.c_str());
+                LOG_ERROR("Error loading elf_file for '%s'\n", path.c_str());
                 return ret;
         }
 
-        ret = elf_file.parse();
+        ret = elf_file.parse(arena);
         if (ret < 0)
         {
-                printf("Error parsing elf file for '%s'\n", path.c_str());
+                LOG_ERROR("Error parsing elf file for '%s'\n", path.c_str());
                 return ret;
         }
 
         convex_hull = elf_file.get_pt_load_convex_hull();
         return ret;
 }
+
+int ElfObject::load_file_backed()
+{
+        const uintptr_t page_mask = sysconf(_SC_PAGE_SIZE) - 1;
+        uintptr_t low = convex_hull.first & ~page_mask;
+        uintptr_t high = (convex_hull.second + page_mask) & ~page_mask;
+        assert(high > low);
+
+        int ret = -1;
+        uintptr_t text_vaddr = 0;
+        if (preferred_base != 0)
+        {
+                ret = load_zone.reserve(high - low, preferred_base + low);
+        }
+        if (ret < 0 && huge_text_vaddr(text_vaddr))
+        {
+                ret = load_zone.map_aligned(high - low, HugePages::SIZE, text_vaddr - low, PROT_NONE, MAP_NORESERVE);
+        }
+        else if (ret < 0 && pooled)
+        {
+                ret = load_zone.map_pooled(high - low, PROT_NONE, MAP_NORESERVE);
+        }
+        if (ret < 0)
+        {
+                ret = load_zone.reserve(high - low);
+        }
+        if (ret < 0)
+        {
+                LOG_ERROR("Error reserving virtual memory\n");
+                return ret;
+        }
+        // Keep base() == ptr - convex_hull.first, the reservation itself starts at the page below
+        load_zone.ptr = (void*)((uintptr_t)load_zone.ptr + (convex_hull.first & page_mask));
+
+        // Segments stay writable until adjust_permissions, pages that relocations never touch
+        // remain shared with the page cache
+        const int prot = PROT_READ | PROT_WRITE;
+        for (const auto & zone : elf_file.load_zones())
+        {
+                if (zone.length == 0) continue;
+
+                uintptr_t start = base() + zone.base;
+                uintptr_t file_end = start + zone.file_length;
+                uintptr_t mem_end = start + zone.length;
+
+                if (zone.file_length > 0)
+                {
+                        uintptr_t map_start = start & ~page_mask;
+                        off_t offset = zone.offset & ~page_mask;
+                        ret = load_zone.map_file_at(map_start, file_end - map_start, prot, elf_file.fd(), offset);
+                        if (ret < 0)
+                        {
+                                LOG_ERROR("Error mapping segment @ 0x%lx from '%s'\n", zone.base, path.c_str());
+                                return ret;
+                        }
+                }
+
+                // .bss: zero the tail of the last file page, the whole pages after it are anonymous
+                uintptr_t anon_start = zone.file_length > 0 ? (file_end + page_mask) & ~page_mask : start & ~page_mask;
+                if (zone.file_length > 0 && mem_end > file_end)
+                {
+                        memset((void*)file_end, 0, std::min(anon_start, mem_end) - file_end);
+                }
+                if (mem_end > anon_start)
+                {
+                        ret = load_zone.map_anonymous_at(anon_start, ((mem_end + page_mask) & ~page_mask) - anon_start, prot);
+                        if (ret < 0)
+                        {
+                                LOG_ERROR("Error mapping .bss @ 0x%lx from '%s'\n", zone.base, path.c_str());
+                                return ret;
+                        }
+                }
+        }
+        back_text_with_huge_pages();
+
+        return 0;
+}
+
+bool ElfObject::huge_text_vaddr(uintptr_t & vaddr) const
+{
+        // Text relocations would go through the relocation cache's file pages
+        if (huge_text == HugePages::Backing::None || elf_file.text_relocations()) return false;
+
+        const uintptr_t page_mask = sysconf(_SC_PAGE_SIZE) - 1;
+        for (const auto & zone : elf_file.load_zones())
+        {
+                uintptr_t start = zone.base & ~page_mask;
+                if ((zone.flags & PROT_EXEC) && zone.base + zone.length - start >= HugePages::SIZE)
+                {
+                        vaddr = start;
+                        return true;
+                }
+        }
+        return false;
+}
+
+// Whole huge pages inside executable segments, the head and tail stay on small pages.
+// Segments are still read-write, the ProtectionPlanner does not see the difference.
+void ElfObject::back_text_with_huge_pages()
+{
+        uintptr_t text_vaddr = 0;
+        if (!huge_text_vaddr(text_vaddr)) return;
+
+        for (const auto & zone : elf_file.load_zones())
+        {
+                if (!(zone.flags & PROT_EXEC)) continue;
+
+                uintptr_t start = (base() + zone.base + HugePages::SIZE - 1) & ~(HugePages::SIZE - 1);
+                uintptr_t end = (base() + zone.base + zone.length) & ~(HugePages::SIZE - 1);
+                if (end <= start) continue;
+
+                HugePages::Backing backing = HugePages::back(start, end - start, huge_text);
+                if (backing == HugePages::Backing::None) continue;
+                huge_text_backing = backing;
+                huge_text_bytes += end - start;
+        }
+        if (huge_text_bytes == 0)
+        {
+                LOG_DEBUG("'%s': text of 0x%lx is not huge page aligned\n", path.c_str(), base() + text_vaddr);
+        }
+}
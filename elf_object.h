@@ -1,10 +1,13 @@
 #pragma once
 
 #include "elf_file.h"
+#include "huge_pages.h"
+#include "log.h"
 #include "mapped_zone.h"
 
 #include <filesystem>
 #include <utility>
+#include <vector>
 
 struct ElfObject
 {
@@ -24,6 +27,16 @@ struct ElfObject
         {
                 path = rhs.path;
                 convex_hull = rhs.convex_hull;
+                preferred_base = rhs.preferred_base;
+                huge_text = rhs.huge_text;
+                huge_text_backing = rhs.huge_text_backing;
+                huge_text_bytes = rhs.huge_text_bytes;
+                pooled = rhs.pooled;
+                initialized = rhs.initialized;
+                references = rhs.references;
+                needed = std::move(rhs.needed);
+                bound = std::move(rhs.bound);
+                closure = std::move(rhs.closure);
                 elf_file = std::move(rhs.elf_file);
                 load_zone = std::move(rhs.load_zone);
 
@@ -33,7 +46,7 @@ struct ElfObject
 
 public:
 
-        int load_and_parse_elf_file(std::filesystem::path path);
+        int load_and_parse_elf_file(std::filesystem::path path, Arena & arena);
 
         uintptr_t base() const
         {
@@ -46,47 +59,92 @@ public:
                 return (void*)((uintptr_t)base() + elf_file.entry_point());
         }
 
-        int load()
+        enum class LoadMode
         {
+                Copy,           // one anonymous mapping, segments are memcpy'd in
+                FileBacked,     // segments are mapped from the file inside a PROT_NONE reservation
+        };
+
+        int load(LoadMode mode = LoadMode::Copy)
+        {
+                if (mode == LoadMode::FileBacked)
+                {
+                        return load_file_backed();
+                }
+
                 size_t length = convex_hull.second - convex_hull.first;
                 assert(length != 0);
-                int ret = load_zone.map(length);
+                int ret = -1;
+                uintptr_t text_vaddr = 0;
+                if (preferred_base != 0)
+                {
+                        ret = load_zone.map(length, preferred_base + convex_hull.first);
+                }
+                if (ret < 0 && huge_text_vaddr(text_vaddr))
+                {
+                        ret = load_zone.map_aligned(length, HugePages::SIZE, text_vaddr - convex_hull.first, load_zone.flags);
+                }
+                else if (ret < 0 && pooled)
+                {
+                        ret = load_zone.map_pooled(length, load_zone.flags);
+                }
                 if (ret < 0)
                 {
-                        printf("Error mapping in virtual memory\n");
+                        ret = load_zone.map(length);
+                }
+                if (ret < 0)
+                {
+                        LOG_ERROR("Error mapping in virtual memory\n");
                         return ret;
                 }
-                memcpy((void*)load_zone.ptr, elf_file.file_data(), load_zone.length);
+                for (const auto & zone : elf_file.load_zones())
+                {
+                        memcpy((void*)(base() + zone.base), elf_file.file_data() + zone.offset, zone.file_length);
+                        if (load_zone.recycled)
+                        {
+                                memset((void*)(base() + zone.base + zone.file_length), 0, zone.length - zone.file_length);
+                        }
+                }
+                back_text_with_huge_pages();
 
                 return 0;
         }
 
-        int set_final_map_protections()
-        {
-                for (int i = 0; i < elf_file.load_zones().size(); ++i)
-                {
-                        const auto & zone = elf_file.load_zones()[i];
-                        if (zone.length == 0) continue;
-                        printf("Setting prot @ 0x%lx...0x%lx | %s%s%s\n",
-                                ((uintptr_t)base() + zone.base),
-                                ((uintptr_t)base() + zone.base + zone.length),
-                                (zone.flags & PF_R) ? "R" : ".",
-                                (zone.flags & PF_W) ? "W" : ".",
-                                (zone.flags & PF_X) ? "X" : "."
-                                );
-                        int ret = mprotect((void*)(((uintptr_t)base() + zone.base) & ~(sysconf(_SC_PAGE_SIZE) - 1)), zone.length, zone.flags);
+        int load_file_backed();
 
-                }
-                return 0;
-
-        }
+        // Page aligned vaddr of the first executable segment spanning at least one huge
+        // page, false when huge_text is off or nothing is worth it
+        bool huge_text_vaddr(uintptr_t & vaddr) const;
+        void back_text_with_huge_pages();
 
+        // Protections are applied for the whole Process, see ProtectionPlanner
 
 public:
 
         std::filesystem::path path;
         ElfFile elf_file;
         ConvexHull convex_hull;
+        // base() asked for by a fixed layout, 0 lets the kernel choose. If the range is
+        // taken the object is mapped anywhere and base() differs.
+        uintptr_t preferred_base = 0;
+        // Executable segments start on a huge page and are backed with the asked for
+        // HugePages::Backing, huge_text_backing is the one obtained
+        HugePages::Backing huge_text = HugePages::Backing::None;
+        HugePages::Backing huge_text_backing = HugePages::Backing::None;
+        size_t huge_text_bytes = 0;
+        // DT_NEEDED entries, as indices in Process::objects_
+        std::vector<int> needed;
+        // Objects outside the DT_NEEDED closure it bound symbols to, through the global
+        // symbol table, as indices in Process::objects_
+        std::vector<int> bound;
+        // closure[j]: objects_[j] is reachable through DT_NEEDED, this one included
+        std::vector<bool> closure;
+        // Objects needing or bound to this one plus handles opened on it, see Process::release_object
+        size_t references = 0;
+        // The reservation comes from and goes back to the MappingPool
+        bool pooled = false;
+        // Its initializers ran, its finalizers run before it is unmapped
+        bool initialized = false;
 
 // private:
         MappedZone load_zone;
@@ -99,6 +99,9 @@ enum DynamicTag : long int
 	FINIARRAYSZ = 28,
 	RUNPATH = 29,
 	FLAGS = 30,
+	RELRSZ = 35,
+	RELR = 36,
+	RELRENT = 37,
 	LOOS = 0X60000000,
 	LOPROC = 0X70000000,
 	HIPROC = 0X7FFFFFFF,
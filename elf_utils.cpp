@@ -1,4 +1,5 @@
 #include "elf_utils.h"
+#include "log.h"
 
 #include <elf.h>
 #include <cassert>
@@ -8,6 +9,8 @@
 
 void print_elf_header(struct elf64_hdr const & hdr)
 {
+	if (!LOG_ENABLED(Log::DEBUG)) return;
+
 	printf("======== ELF Header ======\n");
 	for (int i = 0; i < EI_NIDENT; ++i)
 	{
@@ -32,6 +35,8 @@ void print_elf_header(struct elf64_hdr const & hdr)
 
 void print_program_header(const elf64_phdr & header)
 {
+	if (!LOG_ENABLED(Log::DEBUG)) return;
+
 	std::cout << "p_type:       " << header.p_type  << '\n'  ;
   	std::cout << "p_flags:      " << header.p_flags << '\n'  ;
   	std::cout << "p_offset:     " << header.p_offset << '\n'  ;
@@ -44,6 +49,8 @@ void print_program_header(const elf64_phdr & header)
 
 void print_section_header(const elf64_shdr & header)
 {
+	if (!LOG_ENABLED(Log::DEBUG)) return;
+
 	std::cout << "\tsh_name:        " << header.sh_name << '\n'  ;
   	std::cout << "\tsh_type:        " << sh_rela_type_to_str(header.sh_type) << '\n'  ;
   	std::cout << "\tsh_flags:       " << header.sh_flags<< '\n'  ;
@@ -123,6 +130,12 @@ const char* dynamic_tag_to_str(DynamicTag tag)
 			return "finiarraysz";
 		case FLAGS:
 			return "flags";
+		case RELRSZ:
+			return "relrsz";
+		case RELR:
+			return "relr";
+		case RELRENT:
+			return "relrent";
 		case LOOS:
 			return "loos";
 		case HIOS:
@@ -169,6 +182,8 @@ const char* rela_type_to_str(RelaType type)
 			return "jump_slot";
 		case RELATIVE	:
 			return "relative";
+		case None:
+			return "none";
 	}
 	return (std::string("Unknown: ") + std::to_string(type)).data();
 }
@@ -224,6 +239,8 @@ const char* sh_rela_type_to_str(Elf64_Word type)
 
 void print_rela(const elf64_rela & rel)
 {
+	if (!LOG_ENABLED(Log::DEBUG)) return;
+
 	uint32_t sym = (uint64_t)(rel.r_info) >> 32;
 	RelaType type = (RelaType)(rel.r_info & 0x00000000FFFFFFFF);
 	printf("Rela {\n"
@@ -0,0 +1,144 @@
+#include "huge_pages.h"
+#include "log.h"
+
+#include <cerrno>
+#include <cstring>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#ifndef MFD_HUGE_2MB
+#define MFD_HUGE_2MB (21 << 26)
+#endif
+#ifndef MADV_COLLAPSE
+#define MADV_COLLAPSE 25
+#endif
+
+const char * HugePages::name(Backing backing)
+{
+        switch (backing)
+        {
+                case Backing::Thp:
+                        return "thp";
+                case Backing::Hugetlb:
+                        return "hugetlb";
+                default:
+                        return "none";
+        }
+}
+
+HugePages::Backing HugePages::back(uintptr_t start, size_t length, Backing wanted)
+{
+        if (wanted == Backing::None || length == 0 || start % SIZE != 0 || length % SIZE != 0)
+        {
+                return Backing::None;
+        }
+        if (wanted == Backing::Hugetlb && back_with_hugetlb(start, length))
+        {
+                return Backing::Hugetlb;
+        }
+        return back_with_thp(start, length) ? Backing::Thp : Backing::None;
+}
+
+// The content is copied aside first, then the range is replaced in one MAP_FIXED:
+// it is never unmapped, a concurrent mmap cannot land in it
+bool HugePages::back_with_hugetlb(uintptr_t start, size_t length)
+{
+        int fd = memfd_create("bagpacker-text", MFD_CLOEXEC | MFD_HUGETLB | MFD_HUGE_2MB);
+        if (fd < 0)
+        {
+                LOG_DEBUG("memfd_create(MFD_HUGETLB): %s\n", strerror(errno));
+                return false;
+        }
+        // Without MAP_NORESERVE the pages are reserved here, not at the first fault
+        void * staging = MAP_FAILED;
+        if (ftruncate(fd, length) == 0)
+        {
+                staging = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        }
+        if (staging == MAP_FAILED)
+        {
+                LOG_DEBUG("No hugetlb pages for 0x%lx (%zu bytes), is vm.nr_hugepages set? %s\n", start, length, strerror(errno));
+                close(fd);
+                return false;
+        }
+        memcpy(staging, (const void *)start, length);
+        void * ret = mmap((void *)start, length, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0);
+        munmap(staging, length);
+        close(fd);
+        if (ret == MAP_FAILED)
+        {
+                // MAP_FIXED fails before touching the old mapping
+                LOG_WARNING("Cannot map hugetlb pages @ 0x%lx: %s\n", start, strerror(errno));
+                return false;
+        }
+        return true;
+}
+
+bool HugePages::back_with_thp(uintptr_t start, size_t length)
+{
+        void * staging = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (staging == MAP_FAILED)
+        {
+                return false;
+        }
+        memcpy(staging, (const void *)start, length);
+
+        // A fresh anonymous range, advised before its first fault so faults allocate huge pages
+        bool ret = mmap((void *)start, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) != MAP_FAILED;
+        if (ret && madvise((void *)start, length, MADV_HUGEPAGE) < 0)
+        {
+                LOG_DEBUG("madvise(MADV_HUGEPAGE) @ 0x%lx: %s\n", start, strerror(errno));
+                ret = false;
+        }
+        if (ret)
+        {
+                memcpy((void *)start, staging, length);
+                // Faults may have fallen back to small pages, collapse them now rather than
+                // waiting for khugepaged. Kernels before 6.1 do not know MADV_COLLAPSE.
+                madvise((void *)start, length, MADV_COLLAPSE);
+        }
+        else
+        {
+                LOG_WARNING("Cannot back 0x%lx with transparent huge pages\n", start);
+                // Whatever happened, the range must keep its content
+                memcpy((void *)start, staging, length);
+        }
+        munmap(staging, length);
+        return ret;
+}
+
+size_t HugePages::count(uintptr_t start, uintptr_t end)
+{
+        FILE * smaps = fopen("/proc/self/smaps", "r");
+        if (smaps == nullptr)
+        {
+                return 0;
+        }
+        size_t kib = 0;
+        bool inside = false;
+        char line[512];
+        while (fgets(line, sizeof(line), smaps) != nullptr)
+        {
+                uintptr_t vma_start = 0;
+                uintptr_t vma_end = 0;
+                size_t value = 0;
+                char key[64];
+                // VMA header lines start with the range, field lines with "Name:"
+                if (sscanf(line, "%lx-%lx ", &vma_start, &vma_end) == 2 && strchr(line, '-') < strchr(line, ' '))
+                {
+                        inside = vma_start < end && start < vma_end;
+                }
+                else if (inside && sscanf(line, "%63[^:]: %zu kB", key, &value) == 2
+                        && (strcmp(key, "AnonHugePages") == 0 || strcmp(key, "FilePmdMapped") == 0
+                                || strcmp(key, "Shared_Hugetlb") == 0 || strcmp(key, "Private_Hugetlb") == 0))
+                {
+                        kib += value;
+                }
+                while (strchr(line, '\n') == nullptr && fgets(line, sizeof(line), smaps) != nullptr)
+                {
+                }
+        }
+        fclose(smaps);
+        return kib * 1024 / SIZE;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Huge page backing for executable segments, see ElfObject::huge_text.
+// Large text mapped with 4 KiB pages costs one iTLB entry per page, a 2 MiB
+// page covers 512 of them.
+class HugePages
+{
+public:
+        static constexpr size_t SIZE = 2 << 20;
+
+        enum class Backing
+        {
+                None,
+                Thp,            // anonymous memory, madvise(MADV_HUGEPAGE) then MADV_COLLAPSE
+                Hugetlb,        // memfd_create(MFD_HUGETLB), needs vm.nr_hugepages
+        };
+
+        // Moves the content of [start, start + length), SIZE aligned and mapped read-write,
+        // onto huge pages. Hugetlb falls back to Thp, Thp to leaving the range as it is:
+        // returns the backing obtained.
+        static Backing back(uintptr_t start, size_t length, Backing wanted);
+
+        // Huge pages mapped in [start, end), from /proc/self/smaps
+        static size_t count(uintptr_t start, uintptr_t end);
+
+        static const char * name(Backing backing);
+
+private:
+        static bool back_with_hugetlb(uintptr_t start, size_t length);
+        static bool back_with_thp(uintptr_t start, size_t length);
+};
@@ -0,0 +1,68 @@
+#include "lazy_binding.h"
+#include "log.h"
+#include "process.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// On entry: [rsp] = LazyBinding*, [rsp + 8] = relocation index, [rsp + 16] = return address.
+// Every argument register is preserved across the fixup, rsp is 16-byte aligned for the call.
+asm(R"(
+        .text
+        .globl bagpacker_plt_trampoline
+        .type bagpacker_plt_trampoline, @function
+bagpacker_plt_trampoline:
+        pushq %rax
+        pushq %rcx
+        pushq %rdx
+        pushq %rsi
+        pushq %rdi
+        pushq %r8
+        pushq %r9
+        pushq %r10
+        subq $136, %rsp
+        movdqu %xmm0, 0(%rsp)
+        movdqu %xmm1, 16(%rsp)
+        movdqu %xmm2, 32(%rsp)
+        movdqu %xmm3, 48(%rsp)
+        movdqu %xmm4, 64(%rsp)
+        movdqu %xmm5, 80(%rsp)
+        movdqu %xmm6, 96(%rsp)
+        movdqu %xmm7, 112(%rsp)
+        movq 200(%rsp), %rdi
+        movq 208(%rsp), %rsi
+        call bagpacker_lazy_fixup@PLT
+        movq %rax, %r11
+        movdqu 0(%rsp), %xmm0
+        movdqu 16(%rsp), %xmm1
+        movdqu 32(%rsp), %xmm2
+        movdqu 48(%rsp), %xmm3
+        movdqu 64(%rsp), %xmm4
+        movdqu 80(%rsp), %xmm5
+        movdqu 96(%rsp), %xmm6
+        movdqu 112(%rsp), %xmm7
+        addq $136, %rsp
+        popq %r10
+        popq %r9
+        popq %r8
+        popq %rdi
+        popq %rsi
+        popq %rdx
+        popq %rcx
+        popq %rax
+        addq $16, %rsp
+        jmp *%r11
+        .size bagpacker_plt_trampoline, .-bagpacker_plt_trampoline
+)");
+
+extern "C" uintptr_t bagpacker_lazy_fixup(LazyBinding * binding, uint64_t reloc_index)
+{
+        uintptr_t target = binding->process->bind_lazy_slot(binding->object, reloc_index);
+        if (target == 0)
+        {
+                // Nowhere to return to, the caller expects the function to run
+                LOG_ERROR("Lazy binding failed for relocation %lu, aborting\n", reloc_index);
+                abort();
+        }
+        return target;
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstdint>
+
+class Process;
+
+// What the PLT pushes in GOT[1]: enough for the trampoline to find the import to bind
+struct LazyBinding
+{
+        Process * process = nullptr;
+        int object = -1;
+};
+
+// Installed in GOT[2] of every lazily bound object. PLT0 jumps here with the
+// LazyBinding and the DT_JMPREL index on the stack, the trampoline binds the
+// slot, patches the GOT and tail-jumps to the target.
+extern "C" void bagpacker_plt_trampoline();
+extern "C" uintptr_t bagpacker_lazy_fixup(LazyBinding * binding, uint64_t reloc_index);
@@ -0,0 +1,186 @@
+#include "library_resolver.h"
+#include "log.h"
+
+#include <cstdint>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// glibc's elf/cache.h, new format only: glibc stopped writing the old one in 2.32
+namespace
+{
+        constexpr char CACHE_MAGIC_NEW[] = "glibc-ld.so.cache1.1";
+        constexpr char CACHE_MAGIC_OLD[] = "ld.so-1.7.0";
+
+        constexpr int32_t FLAG_TYPE_MASK = 0x00ff;
+        constexpr int32_t FLAG_ELF_LIBC6 = 0x0003;
+        constexpr int32_t FLAG_REQUIRED_MASK = 0xff00;
+        constexpr int32_t FLAG_X8664_LIB64 = 0x0300;
+
+        struct CacheHeaderOld
+        {
+                char magic[sizeof(CACHE_MAGIC_OLD) - 1];
+                uint32_t nlibs;
+        };
+
+        struct CacheEntryOld
+        {
+                int32_t flags;
+                uint32_t key;
+                uint32_t value;
+        };
+
+        struct CacheHeaderNew
+        {
+                char magic[sizeof(CACHE_MAGIC_NEW) - 1];
+                uint32_t nlibs;
+                uint32_t len_strings;
+                uint8_t flags;
+                uint8_t padding[3];
+                uint32_t extension_offset;
+                uint32_t unused[3];
+        };
+
+        struct CacheEntryNew
+        {
+                int32_t flags;
+                uint32_t key;           // offsets from the new header
+                uint32_t value;
+                uint32_t osversion;
+                uint64_t hwcap;
+        };
+}
+
+int LibraryResolver::load_ld_so_cache()
+{
+        ld_so_cache_loaded_ = true;
+
+        int fd = open(ld_so_cache_path_.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+                return -1;
+        }
+        struct stat st;
+        if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(CacheHeaderNew))
+        {
+                close(fd);
+                return -1;
+        }
+        const char * data = (const char *)mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (data == MAP_FAILED)
+        {
+                return -1;
+        }
+        const size_t size = st.st_size;
+
+        // Old caches may carry the new format after their own entries
+        size_t offset = 0;
+        if (memcmp(data, CACHE_MAGIC_OLD, sizeof(CACHE_MAGIC_OLD) - 1) == 0)
+        {
+                const CacheHeaderOld * old = (const CacheHeaderOld *)data;
+                offset = sizeof(CacheHeaderOld) + (size_t)old->nlibs * sizeof(CacheEntryOld);
+                offset = (offset + alignof(CacheHeaderNew) - 1) & ~(alignof(CacheHeaderNew) - 1);
+        }
+
+        int ret = -1;
+        const CacheHeaderNew * header = (const CacheHeaderNew *)(data + offset);
+        if (offset + sizeof(CacheHeaderNew) <= size
+                && memcmp(header->magic, CACHE_MAGIC_NEW, sizeof(CACHE_MAGIC_NEW) - 1) == 0
+                && offset + sizeof(CacheHeaderNew) + (size_t)header->nlibs * sizeof(CacheEntryNew) <= size)
+        {
+                const char * strings = data + offset;
+                const size_t strings_size = size - offset;
+                const CacheEntryNew * entries = (const CacheEntryNew *)(header + 1);
+                for (uint32_t i = 0; i < header->nlibs; ++i)
+                {
+                        const CacheEntryNew & entry = entries[i];
+                        if ((entry.flags & FLAG_TYPE_MASK) != FLAG_ELF_LIBC6
+                                || (entry.flags & FLAG_REQUIRED_MASK) != FLAG_X8664_LIB64
+                                || entry.key >= strings_size || entry.value >= strings_size)
+                        {
+                                continue;
+                        }
+                        const char * key = strings + entry.key;
+                        const char * value = strings + entry.value;
+                        if (strnlen(key, strings_size - entry.key) == strings_size - entry.key
+                                || strnlen(value, strings_size - entry.value) == strings_size - entry.value)
+                        {
+                                continue;
+                        }
+                        // Entries are sorted by preference, the first one wins as in ld.so
+                        ld_so_cache_.emplace(key, value);
+                }
+                stats_.cache_entries = ld_so_cache_.size();
+                ret = 0;
+        }
+        else
+        {
+                LOG_WARNING("Ignoring '%s': unsupported format\n", ld_so_cache_path_.c_str());
+        }
+
+        munmap((void *)data, size);
+        return ret;
+}
+
+bool LibraryResolver::directory_contains(const std::filesystem::path & directory, const std::string & name)
+{
+        auto [it, inserted] = directories_.try_emplace(directory.string());
+        if (inserted)
+        {
+                // A missing directory stays an empty set, it is never listed again
+                DIR * dir = opendir(directory.empty() ? "." : directory.c_str());
+                if (dir != nullptr)
+                {
+                        while (const struct dirent * entry = readdir(dir))
+                        {
+                                it->second.emplace(entry->d_name);
+                        }
+                        closedir(dir);
+                }
+                ++stats_.directories_listed;
+                stats_.directory_entries += it->second.size();
+        }
+        return it->second.count(name) > 0;
+}
+
+int LibraryResolver::resolve(const std::string & name, const std::vector<std::filesystem::path> & search_paths,
+        std::filesystem::path & full_path)
+{
+        ++stats_.lookups;
+        for (const auto & directory : search_paths)
+        {
+                if (directory_contains(directory, name))
+                {
+                        ++stats_.directory_hits;
+                        full_path = directory / name;
+                        return 0;
+                }
+        }
+
+        if (!ld_so_cache_loaded_)
+        {
+                load_ld_so_cache();
+        }
+        auto it = ld_so_cache_.find(name);
+        if (it != ld_so_cache_.end())
+        {
+                ++stats_.cache_hits;
+                full_path = it->second;
+                return 0;
+        }
+
+        for (const auto & directory : default_paths_)
+        {
+                if (directory_contains(directory, name))
+                {
+                        ++stats_.directory_hits;
+                        full_path = directory / name;
+                        return 0;
+                }
+        }
+        return -1;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Finds the file behind a DT_NEEDED name without a stat per search path.
+//
+// Directories are listed once, on first use, and kept as a set of names: a
+// lookup in a RUNPATH or $ORIGIN directory is a hash probe, including when the
+// name is not there. System libraries come from /etc/ld.so.cache, parsed once,
+// then from the default directories. Not thread-safe, Process resolves names
+// from a single thread.
+class LibraryResolver
+{
+public:
+        struct Stats
+        {
+                size_t lookups = 0;
+                size_t directory_hits = 0;
+                size_t cache_hits = 0;
+                size_t directories_listed = 0;
+                size_t directory_entries = 0;
+                size_t cache_entries = 0;
+        };
+
+        static constexpr const char * LD_SO_CACHE = "/etc/ld.so.cache";
+
+        explicit LibraryResolver(std::filesystem::path ld_so_cache = LD_SO_CACHE)
+                : ld_so_cache_path_(std::move(ld_so_cache))
+        {
+        }
+
+        // `search_paths` first, in order, then ld.so.cache, then the default directories
+        int resolve(const std::string & name, const std::vector<std::filesystem::path> & search_paths,
+                std::filesystem::path & full_path);
+
+        // Lists `directory` the first time only
+        bool directory_contains(const std::filesystem::path & directory, const std::string & name);
+
+        const Stats & stats() const noexcept
+        {
+                return stats_;
+        }
+
+private:
+        int load_ld_so_cache();
+
+private:
+        std::filesystem::path ld_so_cache_path_;
+        bool ld_so_cache_loaded_ = false;
+        // soname -> path, for the libraries of this architecture
+        std::unordered_map<std::string, std::string> ld_so_cache_;
+        std::unordered_map<std::string, std::unordered_set<std::string>> directories_;
+        std::vector<std::filesystem::path> default_paths_ {
+                "/lib/x86_64-linux-gnu", "/usr/lib/x86_64-linux-gnu", "/lib64", "/usr/lib64",
+        };
+        Stats stats_;
+};
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdarg>
+#include <cstdio>
+
+// Diagnostics are filtered twice. At compile time against BAGPACKER_LOG_LEVEL:
+// a message above it is discarded with its arguments, so it costs nothing even
+// in hot loops. At run time against Log::verbosity, raised with -v.
+//
+// Release builds (NDEBUG) keep errors and warnings only, debug builds keep
+// everything and print up to INFO unless asked for more.
+#ifndef BAGPACKER_LOG_LEVEL
+#ifdef NDEBUG
+#define BAGPACKER_LOG_LEVEL 1
+#else
+#define BAGPACKER_LOG_LEVEL 4
+#endif
+#endif
+
+struct Log
+{
+        enum Level
+        {
+                ERROR = 0,
+                WARNING = 1,
+                INFO = 2,
+                DEBUG = 3,
+                TRACE = 4,
+        };
+
+        static constexpr int COMPILED_LEVEL = BAGPACKER_LOG_LEVEL;
+        static inline int verbosity = INFO;
+
+        // Errors and warnings go to the unbuffered stderr, they often precede an abort
+        __attribute__((format(printf, 2, 3)))
+        static void print(int level, const char * format, ...)
+        {
+                va_list args;
+                va_start(args, format);
+                vfprintf(level <= WARNING ? stderr : stdout, format, args);
+                va_end(args);
+        }
+};
+
+#define LOG_ENABLED(level) ((level) <= Log::COMPILED_LEVEL && (level) <= Log::verbosity)
+
+#define BAGPACKER_LOG(level, ...)                                       \
+        do                                                              \
+        {                                                               \
+                if constexpr ((level) <= Log::COMPILED_LEVEL)           \
+                {                                                       \
+                        if ((level) <= Log::verbosity)                  \
+                        {                                               \
+                                Log::print((level), __VA_ARGS__);       \
+                        }                                               \
+                }                                                       \
+        } while (0)
+
+#define LOG_ERROR(...) BAGPACKER_LOG(Log::ERROR, __VA_ARGS__)
+#define LOG_WARNING(...) BAGPACKER_LOG(Log::WARNING, __VA_ARGS__)
+#define LOG_INFO(...) BAGPACKER_LOG(Log::INFO, __VA_ARGS__)
+#define LOG_DEBUG(...) BAGPACKER_LOG(Log::DEBUG, __VA_ARGS__)
+#define LOG_TRACE(...) BAGPACKER_LOG(Log::TRACE, __VA_ARGS__)
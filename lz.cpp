@@ -0,0 +1,178 @@
+#include "lz.h"
+
+#include <cstdint>
+#include <string.h>
+
+namespace
+{
+
+constexpr int HASH_BITS = 14;
+constexpr size_t MIN_MATCH = 4;
+constexpr size_t MAX_OFFSET = 65535;
+// Matches stop this far from the end, the tail is always literals
+constexpr size_t END_LITERALS = 12;
+
+uint32_t read32(const char * p)
+{
+        uint32_t v;
+        memcpy(&v, p, 4);
+        return v;
+}
+
+uint32_t hash32(uint32_t v)
+{
+        return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+// Lengths >= 15 continue in 255-valued bytes
+char * write_length(char * op, size_t length)
+{
+        for (; length >= 255; length -= 255)
+        {
+                *op++ = (char)255;
+        }
+        *op++ = (char)length;
+        return op;
+}
+
+}
+
+size_t lz_compress_bound(size_t size)
+{
+        return size + size / 255 + 16;
+}
+
+size_t lz_compress(const char * src, size_t size, char * dst, size_t capacity)
+{
+        if (capacity < lz_compress_bound(size))
+        {
+                return 0;
+        }
+
+        uint32_t table[1 << HASH_BITS];
+        memset(table, 0xff, sizeof(table));
+
+        char * op = dst;
+        size_t anchor = 0;
+        size_t ip = 0;
+        const size_t limit = size > END_LITERALS ? size - END_LITERALS : 0;
+
+        auto emit = [&](size_t literals_end, size_t offset, size_t match_length) {
+                size_t literals = literals_end - anchor;
+                char * token = op++;
+                *token = (char)((literals >= 15 ? 15 : literals) << 4);
+                if (literals >= 15) op = write_length(op, literals - 15);
+                memcpy(op, src + anchor, literals);
+                op += literals;
+                if (match_length == 0) return;
+
+                *op++ = (char)(offset & 0xff);
+                *op++ = (char)(offset >> 8);
+                size_t length = match_length - MIN_MATCH;
+                *token |= (char)(length >= 15 ? 15 : length);
+                if (length >= 15) op = write_length(op, length - 15);
+        };
+
+        while (ip < limit)
+        {
+                uint32_t sequence = read32(src + ip);
+                uint32_t & slot = table[hash32(sequence)];
+                size_t ref = slot;
+                slot = (uint32_t)ip;
+
+                if (ref == 0xffffffff || ip - ref > MAX_OFFSET || read32(src + ref) != sequence)
+                {
+                        ++ip;
+                        continue;
+                }
+
+                size_t length = MIN_MATCH;
+                while (ip + length < limit && src[ref + length] == src[ip + length])
+                {
+                        ++length;
+                }
+                emit(ip, ip - ref, length);
+                ip += length;
+                anchor = ip;
+        }
+
+        emit(size, 0, 0);
+        return op - dst;
+}
+
+long lz_decompress(const char * src, size_t size, char * dst, size_t capacity)
+{
+        const unsigned char * ip = (const unsigned char *)src;
+        const unsigned char * const end = ip + size;
+        char * op = dst;
+        char * const op_end = dst + capacity;
+
+        auto read_length = [&](size_t & length) {
+                unsigned char byte = 255;
+                while (byte == 255)
+                {
+                        if (ip >= end) return false;
+                        byte = *ip++;
+                        length += byte;
+                }
+                return true;
+        };
+
+        while (ip < end)
+        {
+                unsigned char token = *ip++;
+
+                size_t literals = token >> 4;
+                if (literals == 15 && !read_length(literals)) return -1;
+                if (literals > (size_t)(end - ip) || literals > (size_t)(op_end - op)) return -1;
+                if (literals <= 16 && end - ip >= 16 && op_end - op >= 16)
+                {
+                        // Fixed size copy, the extra bytes are overwritten by what follows
+                        memcpy(op, ip, 16);
+                }
+                else
+                {
+                        memcpy(op, ip, literals);
+                }
+                ip += literals;
+                op += literals;
+
+                // The last sequence has no match
+                if (ip == end) break;
+
+                if (end - ip < 2) return -1;
+                size_t offset = ip[0] | (ip[1] << 8);
+                ip += 2;
+                if (offset == 0 || offset > (size_t)(op - dst)) return -1;
+
+                size_t length = token & 15;
+                if (length == 15 && !read_length(length)) return -1;
+                length += MIN_MATCH;
+                if (length > (size_t)(op_end - op)) return -1;
+
+                const char * match = op - offset;
+                if (offset >= 16 && (size_t)(op_end - op) >= length + 16)
+                {
+                        // 16 bytes at a time, may write past the match but never past op_end
+                        for (size_t i = 0; i < length; i += 16)
+                        {
+                                memcpy(op + i, match + i, 16);
+                        }
+                        op += length;
+                }
+                else if (offset >= length)
+                {
+                        memcpy(op, match, length);
+                        op += length;
+                }
+                else
+                {
+                        // Overlapping copy repeats the last `offset` bytes
+                        for (size_t i = 0; i < length; ++i)
+                        {
+                                *op++ = *match++;
+                        }
+                }
+        }
+        return op - dst;
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstddef>
+
+// Small LZ77 block codec in the spirit of LZ4: byte oriented, 64 KiB window,
+// no entropy stage. Decompression runs at memory speed and writes straight
+// into its destination, which is what packed images need.
+
+// Worst case size of lz_compress's output for `size` input bytes
+size_t lz_compress_bound(size_t size);
+
+// Returns the compressed size, or 0 if `capacity` is too small
+size_t lz_compress(const char * src, size_t size, char * dst, size_t capacity);
+
+// Returns the decompressed size, or -1 on malformed input or if `capacity` is too small
+long lz_decompress(const char * src, size_t size, char * dst, size_t capacity);
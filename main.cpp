@@ -2,7 +2,13 @@
 #include "mapped_zone.h"
 #include "elf_utils.h"
 #include "elf_file.h"
+#include "log.h"
+#include "packed_image.h"
+#include "packer.h"
+#include "pipeline.h"
+#include "trace.h"
 #include "process.h"
+#include "zygote.h"
 
 #include <string.h>
 #include <sys/mman.h>
@@ -11,45 +17,271 @@
 #include <iostream>
 #include <unistd.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
 #include <fcntl.h>
 #include <cassert>
+#include <getopt.h>
 #include <utility>
 
+static void usage(const char * name)
+{
+	printf("Usage: %s [options] <elf file>\n"
+		"       %s --pack <output> [options] <elf file>\n"
+		"       %s --run-packed <packed image>\n"
+		"       %s --zygote <socket> [options] <elf file>\n"
+		"       %s --launch <socket> [arguments...]\n"
+		"  -m, --map-file    map segments straight from the files instead of copying them\n"
+		"  -l, --lazy        bind PLT slots on first call instead of at load time\n"
+		"      --bind-now    bind every PLT slot at load time (default)\n"
+		"      --huge-text[=thp|hugetlb]\n"
+		"                    start large executable segments on 2 MiB pages (default thp)\n"
+		"  -j, --jobs N      open, parse and map the libraries of each BFS level on N threads,\n"
+		"                    shared by every parallel stage; auto: as many as the cgroup CPU\n"
+		"                    quota and the affinity mask allow\n"
+		"      --prefetch    read the dependencies of an object ahead while it is mapped\n"
+		"      --pipeline    load and relocate each object as soon as its parent is parsed,\n"
+		"                    on -j threads (default 4) instead of one phase after the other\n"
+		"  -c, --cache-dir D map objects at fixed addresses and reuse relocated images cached in D\n"
+		"  -s, --stats       print loader statistics before jumping to the entry point\n"
+		"  -v, --verbose     print more diagnostics, repeat for more (up to the level compiled in)\n"
+		"  -q, --quiet       print errors and warnings only\n"
+		"  -t, --trace FILE  write a timeline of every phase and object as Chrome trace events\n"
+		"  -p, --pack OUT    relocate and bind everything at a fixed layout, write it as one image\n"
+		"  -z, --compress    with --pack, store segments LZ compressed when that is smaller\n"
+		"  -r, --run-packed  the file is a packed image: map it and jump, decompressing on -j threads\n"
+		"      --zygote S    load, relocate and protect once, then fork the program for every\n"
+		"                    request on the Unix socket S, with the request's arguments\n"
+		"      --launch S    run the program of the zygote on S with these arguments and this\n"
+		"                    terminal, exit with its status\n"
+		, name, name, name, name, name);
+}
+
 int main(int argc, char** argv)
 {
-	if (argc == 1)
+	Process process;
+	bool print_stats = false;
+	const char * pack_output = nullptr;
+	bool run_packed = false;
+	bool compress = false;
+	const char * trace_output = nullptr;
+	const char * zygote_socket = nullptr;
+	const char * launch_socket = nullptr;
+	bool pipeline = false;
+	bool jobs_given = false;
+
+	static const struct option long_options[] = {
+		{"map-file", no_argument, nullptr, 'm'},
+		{"lazy", no_argument, nullptr, 'l'},
+		{"bind-now", no_argument, nullptr, 'n'},
+		{"huge-text", optional_argument, nullptr, 'H'},
+		{"jobs", required_argument, nullptr, 'j'},
+		{"prefetch", no_argument, nullptr, 'P'},
+		{"pipeline", no_argument, nullptr, 'Y'},
+		{"cache-dir", required_argument, nullptr, 'c'},
+		{"stats", no_argument, nullptr, 's'},
+		{"verbose", no_argument, nullptr, 'v'},
+		{"quiet", no_argument, nullptr, 'q'},
+		{"trace", required_argument, nullptr, 't'},
+		{"pack", required_argument, nullptr, 'p'},
+		{"compress", no_argument, nullptr, 'z'},
+		{"run-packed", no_argument, nullptr, 'r'},
+		{"zygote", required_argument, nullptr, 'Z'},
+		{"launch", required_argument, nullptr, 'L'},
+		{"help", no_argument, nullptr, 'h'},
+		{nullptr, 0, nullptr, 0},
+	};
+
+	int opt = 0;
+	while ((opt = getopt_long(argc, argv, "+mlj:c:svqt:p:zrh", long_options, nullptr)) != -1)
 	{
-		printf("Missing args\n");
-		return 0;
+		switch (opt)
+		{
+			case 'm':
+				process.load_mode_ = ElfObject::LoadMode::FileBacked;
+				break;
+			case 'l':
+				process.lazy_binding_ = true;
+				break;
+			case 'n':
+				process.lazy_binding_ = false;
+				break;
+			case 'H':
+				if (optarg == nullptr || strcmp(optarg, "thp") == 0)
+				{
+					process.huge_text_ = HugePages::Backing::Thp;
+				}
+				else if (strcmp(optarg, "hugetlb") == 0)
+				{
+					process.huge_text_ = HugePages::Backing::Hugetlb;
+				}
+				else
+				{
+					LOG_ERROR("Invalid huge page backing '%s'\n", optarg);
+					return 1;
+				}
+				break;
+			case 'j':
+				jobs_given = true;
+				process.jobs_ = strcmp(optarg, "auto") == 0 ? ThreadPool::available_cpus() : atoi(optarg);
+				if (process.jobs_ < 1)
+				{
+					LOG_ERROR("Invalid job count '%s'\n", optarg);
+					return 1;
+				}
+				break;
+			case 'P':
+				process.prefetch_ = true;
+				break;
+			case 'Y':
+				pipeline = true;
+				break;
+			case 'c':
+				process.fixed_layout_ = true;
+				process.relocation_cache_ = std::make_unique<RelocationCache>(optarg);
+				break;
+			case 's':
+				print_stats = true;
+				break;
+			case 'v':
+				++Log::verbosity;
+				break;
+			case 'q':
+				Log::verbosity = Log::WARNING;
+				break;
+			case 't':
+				trace_output = optarg;
+				Trace::enable();
+				break;
+			case 'p':
+				pack_output = optarg;
+				break;
+			case 'z':
+				compress = true;
+				break;
+			case 'r':
+				run_packed = true;
+				break;
+			case 'Z':
+				zygote_socket = optarg;
+				break;
+			case 'L':
+				launch_socket = optarg;
+				break;
+			case 'h':
+				usage(argv[0]);
+				return 0;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
 	}
 
+	if (launch_socket != nullptr)
+	{
+		int status = 0;
+		if (Zygote::launch(launch_socket, std::vector<std::string>(argv + optind, argv + argc), status) < 0)
+		{
+			return 2;
+		}
+		return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+	}
 
-	std::filesystem::path file = argv[1];
+	if (optind >= argc)
+	{
+		LOG_ERROR("Missing args\n");
+		return 0;
+	}
 
-	Process process;
-        int ret = 0;
+	std::filesystem::path file = argv[optind];
+	int ret = 0;
 
-	ret = process.load_object_and_dependencies(file);
-	if (ret < 0)
+	if (run_packed)
 	{
-		return 2;
+		PackedImage image;
+		if (image.map(file, process.jobs_) < 0)
+		{
+			return 2;
+		}
+		return image.run();
 	}
-	std::cout << process;
 
-
-	ret = process.apply_relocations();
-	if (ret < 0)
+	if (pack_output != nullptr)
 	{
-		printf("Could not apply relocations\n");
+		Packer packer;
+		packer.process().load_mode_ = process.load_mode_;
+		packer.process().jobs_ = process.jobs_;
+		packer.set_compress(compress);
+		ret = packer.pack(file, pack_output) < 0 ? 2 : 0;
+		if (trace_output != nullptr)
+		{
+			Trace::write(trace_output);
+		}
 		return ret;
 	}
+
+	if (pipeline)
+	{
+		if (process.fixed_layout_)
+		{
+			LOG_ERROR("--pipeline cannot be combined with --cache-dir\n");
+			return 1;
+		}
+		if (!jobs_given)
+		{
+			process.jobs_ = Pipeline::DEFAULT_THREADS;
+		}
+		ret = Pipeline(process).run(file);
+		if (ret < 0)
+		{
+			return 2;
+		}
+		if (LOG_ENABLED(Log::INFO))
+		{
+			std::cout << process;
+		}
+	}
+	else
+	{
+		ret = process.load_object_and_dependencies(file);
+		if (ret < 0)
+		{
+			return 2;
+		}
+		if (LOG_ENABLED(Log::INFO))
+		{
+			std::cout << process;
+		}
+
+
+		ret = process.apply_relocations();
+		if (ret < 0)
+		{
+			LOG_ERROR("Could not apply relocations\n");
+			return ret;
+		}
+	}
 	ret = process.adjust_permissions();
 	if (ret < 0)
 	{
-		printf("Could not adjust permissions\n");
+		LOG_ERROR("Could not adjust permissions\n");
 		return ret;
 	}
 
+	if (print_stats)
+	{
+		process.print_stats();
+	}
+	// Written now, the program may never return
+	if (trace_output != nullptr)
+	{
+		Trace::write(trace_output);
+	}
+
+	if (zygote_socket != nullptr)
+	{
+		return Zygote::serve(process, zygote_socket) < 0 ? 2 : 0;
+	}
+
 	ret = process.run();
 
 	return ret;
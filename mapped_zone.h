@@ -1,6 +1,7 @@
 #pragma once
 
 #include "constants.h"
+#include "log.h"
 
 #include <sys/mman.h>
 #include <cassert>
@@ -9,6 +10,112 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <iostream>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#ifndef MADV_FREE
+#define MADV_FREE 8
+#endif
+
+// Address ranges of unloaded objects, kept mapped for the next object of a similar size:
+// reusing one costs an mprotect instead of mmap + munmap, and anonymous pages the kernel
+// did not reclaim yet (MADV_FREE) are not faulted in again
+class MappingPool
+{
+public:
+	struct Stats
+	{
+		size_t requests = 0;
+		size_t hits = 0;
+		size_t releases = 0;
+		size_t evictions = 0;
+		size_t bytes = 0;	// held right now
+	};
+
+	static constexpr size_t MAX_RANGES = 64;
+	static constexpr size_t MAX_BYTES = (size_t)1 << 30;
+
+	// Smallest pooled range of [length, 5/4 length), its whole length goes to capacity
+	static void * acquire(size_t length, size_t & capacity)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		++stats_.requests;
+		size_t best = ranges_.size();
+		for (size_t k = 0; k < ranges_.size(); ++k)
+		{
+			if (ranges_[k].length >= length && ranges_[k].length < length + length / 4 + 1
+				&& (best == ranges_.size() || ranges_[k].length < ranges_[best].length))
+			{
+				best = k;
+			}
+		}
+		if (best == ranges_.size())
+		{
+			return nullptr;
+		}
+		++stats_.hits;
+		Range range = ranges_[best];
+		ranges_.erase(ranges_.begin() + best);
+		stats_.bytes -= range.length;
+		capacity = range.length;
+		return range.ptr;
+	}
+
+	// File mappings are replaced by a bare reservation, anonymous pages are only
+	// marked free. The oldest ranges are unmapped past MAX_RANGES or MAX_BYTES.
+	static void release(void * ptr, size_t length, bool file_mappings)
+	{
+		if (file_mappings)
+		{
+			if (mmap(ptr, length, PROT_NONE, MAP_ANONYMOUS | MAP_PRIVATE | MAP_NORESERVE | MAP_FIXED, -1, 0) == MAP_FAILED)
+			{
+				munmap(ptr, length);
+				return;
+			}
+		}
+		else
+		{
+			// Fails on shared (hugetlb) pages, which simply stay
+			madvise(ptr, length, MADV_FREE);
+		}
+
+		std::lock_guard<std::mutex> lock(mutex_);
+		++stats_.releases;
+		ranges_.push_back(Range{ptr, length});
+		stats_.bytes += length;
+		while (ranges_.size() > MAX_RANGES || stats_.bytes > MAX_BYTES)
+		{
+			munmap(ranges_.front().ptr, ranges_.front().length);
+			stats_.bytes -= ranges_.front().length;
+			++stats_.evictions;
+			ranges_.erase(ranges_.begin());
+		}
+	}
+
+	static Stats stats()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		return stats_;
+	}
+
+	static double hit_rate()
+	{
+		Stats current = stats();
+		return current.requests > 0 ? (double)current.hits / current.requests : 0.0;
+	}
+
+private:
+	struct Range
+	{
+		void * ptr;
+		size_t length;
+	};
+
+	static inline std::mutex mutex_;
+	static inline std::vector<Range> ranges_;
+	static inline Stats stats_ {0, 0, 0, 0, 0};
+};
 
 
 struct MappedZone
@@ -16,6 +123,11 @@ struct MappedZone
 	void * ptr = nullptr;
 	size_t length = 0;
 	int flags = PROT_READ | PROT_WRITE;
+	// Given back to the MappingPool instead of unmapped
+	bool pooled = false;
+	// Taken from the MappingPool: pages hold whatever the previous object left
+	bool recycled = false;
+	bool file_mappings = false;
 
 	MappedZone () = default;
 
@@ -23,10 +135,7 @@ struct MappedZone
 	MappedZone & operator=(const MappedZone & zone) = delete;
 	MappedZone(MappedZone && zone)
 	{
-		ptr = zone.ptr;
-		length = zone.length;
-		flags = zone.flags;
-		zone.ptr = nullptr;
+		*this = std::move(zone);
 	}
 
 	MappedZone & operator=(MappedZone && zone)
@@ -34,6 +143,9 @@ struct MappedZone
 		ptr = zone.ptr;
 		length = zone.length;
 		flags = zone.flags;
+		pooled = zone.pooled;
+		recycled = zone.recycled;
+		file_mappings = zone.file_mappings;
 		zone.ptr = nullptr;
 		return *this;
 	}
@@ -41,10 +153,15 @@ struct MappedZone
 	~MappedZone()
 	{
 		if (ptr == nullptr) return;
+		if (pooled)
+		{
+			MappingPool::release((void*)((uintptr_t)ptr & ~(sysconf(_SC_PAGE_SIZE) - 1)), length, file_mappings);
+			return;
+		}
 		int ret = munmap((void*)((uintptr_t)ptr & ~(sysconf(_SC_PAGE_SIZE) - 1)), length);
 		if (ret < 0)
 		{
-			printf("MappedZone::free: munmap: [%p] (%lu): %s\n", ptr, length, strerror(errno));
+			LOG_ERROR("MappedZone::free: munmap: [%p] (%lu): %s\n", ptr, length, strerror(errno));
 		}
 	};
 
@@ -58,17 +175,17 @@ struct MappedZone
 		int ret = mprotect((void*)((uintptr_t)ptr & ~(sysconf(_SC_PAGE_SIZE) - 1)), length, flags);
 		if (ret != 0)
 		{
-			printf("MappedZone::set_flags: mprotect (%d): %s\n", errno, strerror(errno));
+			LOG_ERROR("MappedZone::set_flags: mprotect (%d): %s\n", errno, strerror(errno));
 			switch(errno)
 			{
 				case ENOMEM:
-					std::cerr << "ENOMEM\n";
+					LOG_ERROR("ENOMEM\n");
 					break;
 				case EACCES:
-					std::cerr << "EACCESS\n";
+					LOG_ERROR("EACCESS\n");
 					break;
 				case EINVAL:
-					printf("EINVAL: Invalid flags: %d\n", flags);
+					LOG_ERROR("EINVAL: Invalid flags: %d\n", flags);
 					break;
 
 			}
@@ -77,16 +194,126 @@ struct MappedZone
 	}
 
 
-	int map(size_t length_)
+	// A non-zero address is a requirement, not a hint: the mapping fails if the range is taken
+	int map(size_t length_, uintptr_t address = 0)
+	{
+		return map_with_prot(length_, flags, address, 0);
+	}
+
+	// Reserves address space without committing memory, sub-ranges are then mapped with MAP_FIXED
+	int reserve(size_t length_, uintptr_t address = 0)
+	{
+		return map_with_prot(length_, PROT_NONE, address, MAP_NORESERVE);
+	}
+
+	// Takes a range of the MappingPool when one fits, and gives it back when destroyed.
+	// length may end up larger than length_, the tail is never used.
+	int map_pooled(size_t length_, int prot, int extra_flags = 0)
+	{
+		const uintptr_t page_mask = sysconf(_SC_PAGE_SIZE) - 1;
+		length_ = (length_ + page_mask) & ~page_mask;
+		size_t capacity = 0;
+		void * range = MappingPool::acquire(length_, capacity);
+		if (range != nullptr && mprotect(range, capacity, prot) == 0)
+		{
+			ptr = range;
+			length = capacity;
+			recycled = true;
+		}
+		else
+		{
+			if (range != nullptr)
+			{
+				munmap(range, capacity);
+			}
+			if (map_with_prot(length_, prot, 0, extra_flags) < 0)
+			{
+				return -1;
+			}
+		}
+		pooled = true;
+		return 0;
+	}
+
+	// Maps at a kernel chosen ptr with (ptr + offset) % alignment == 0: over-reserves by
+	// alignment and gives back the head and the tail
+	int map_aligned(size_t length_, size_t alignment, size_t offset, int prot, int extra_flags = 0)
 	{
+		const uintptr_t page_mask = sysconf(_SC_PAGE_SIZE) - 1;
+		if ((offset & page_mask) != 0 || map_with_prot(length_ + alignment, prot, 0, extra_flags) < 0)
+		{
+			return -1;
+		}
+		uintptr_t raw = (uintptr_t)ptr;
+		uintptr_t raw_end = (raw + length_ + alignment + page_mask) & ~page_mask;
+		uintptr_t start = (raw + offset + alignment - 1) / alignment * alignment - offset;
+		uintptr_t end = (start + length_ + page_mask) & ~page_mask;
+		if (start > raw)
+		{
+			munmap((void*)raw, start - raw);
+		}
+		if (raw_end > end)
+		{
+			munmap((void*)end, raw_end - end);
+		}
+		ptr = (void*)start;
 		length = length_;
-		ptr = mmap(nullptr, length, flags,  MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+		return 0;
+	}
+
+	int map_file_at(uintptr_t address, size_t length_, int prot, int fd, off_t offset)
+	{
+		assert(contains(address, length_));
+		void * ret = mmap((void*)address, length_, prot, MAP_PRIVATE | MAP_FIXED, fd, offset);
+		if (ret == MAP_FAILED)
+		{
+			LOG_ERROR("MappedZone::map_file_at: mmap: [0x%lx] (%lu): %s\n", address, length_, strerror(errno));
+			return -1;
+		}
+		file_mappings = true;
+		return 0;
+	}
+
+	int map_anonymous_at(uintptr_t address, size_t length_, int prot)
+	{
+		assert(contains(address, length_));
+		void * ret = mmap((void*)address, length_, prot, MAP_ANONYMOUS | MAP_PRIVATE | MAP_FIXED, -1, 0);
+		if (ret == MAP_FAILED)
+		{
+			LOG_ERROR("MappedZone::map_anonymous_at: mmap: [0x%lx] (%lu): %s\n", address, length_, strerror(errno));
+			return -1;
+		}
+		return 0;
+	}
+
+	int map_with_prot(size_t length_, int prot, uintptr_t address, int extra_flags)
+	{
+		length = length_;
+		int map_flags = MAP_ANONYMOUS | MAP_PRIVATE | extra_flags | (address ? MAP_FIXED_NOREPLACE : 0);
+		ptr = mmap((void*)address, length, prot, map_flags, -1, 0);
 		if (ptr == MAP_FAILED)
 		{
-			std::cerr << "MappedZone::map: mmap: " << strerror(errno) << '\n';
+			ptr = nullptr;
+			LOG_ERROR("MappedZone::map: mmap: %s\n", strerror(errno));
+			return -1;
+		}
+		if (address != 0 && (uintptr_t)ptr != address)
+		{
+			// Kernels without MAP_FIXED_NOREPLACE treat the address as a hint
+			munmap(ptr, length);
+			ptr = nullptr;
+			LOG_WARNING("MappedZone::map: 0x%lx is not available\n", address);
 			return -1;
 		}
 		return 0;
 	}
+
+	bool contains(uintptr_t address, size_t length_) const
+	{
+		const uintptr_t page_mask = sysconf(_SC_PAGE_SIZE) - 1;
+		uintptr_t start = (uintptr_t)ptr & ~page_mask;
+		uintptr_t end = (start + length + page_mask) & ~page_mask;
+		return address >= start && address + length_ <= end;
+	}
 };
 
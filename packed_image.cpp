@@ -0,0 +1,233 @@
+#include "packed_image.h"
+#include "log.h"
+#include "lz.h"
+#include "thread_pool.h"
+
+#include <atomic>
+#include <cerrno>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+int PackedImage::map(const std::filesystem::path & path, int threads)
+{
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+                LOG_ERROR("Cannot open packed image '%s': %s\n", path.c_str(), strerror(errno));
+                return -1;
+        }
+
+        Header header;
+        if (pread(fd, &header, sizeof(header), 0) != sizeof(header)
+                || memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0
+                || header.version != VERSION)
+        {
+                LOG_ERROR("'%s' is not a packed image\n", path.c_str());
+                close(fd);
+                return -1;
+        }
+
+        segments.resize(header.segment_count);
+        size_t table_size = segments.size() * sizeof(Segment);
+        if (pread(fd, segments.data(), table_size, sizeof(header)) != (ssize_t)table_size)
+        {
+                LOG_ERROR("Truncated packed image '%s'\n", path.c_str());
+                segments.clear();
+                close(fd);
+                return -1;
+        }
+
+        // Compressed segments are read through one view of the whole image
+        const char * view = nullptr;
+        struct stat st;
+        fstat(fd, &st);
+        std::vector<const Segment *> compressed;
+
+        for (const auto & segment : segments)
+        {
+                if (segment.compression != NONE)
+                {
+                        if (view == nullptr)
+                        {
+                                view = (const char *)mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                                if (view == MAP_FAILED)
+                                {
+                                        LOG_ERROR("Cannot map packed image '%s': %s\n", path.c_str(), strerror(errno));
+                                        close(fd);
+                                        return -1;
+                                }
+                        }
+                        if (segment.file_offset + segment.stored_length > (uint64_t)st.st_size)
+                        {
+                                LOG_ERROR("Truncated segment @ 0x%lx\n", segment.address);
+                                close(fd);
+                                return -1;
+                        }
+                        // Writable until decompressed, see below
+                        void * ret = mmap((void*)segment.address, segment.memory_length, PROT_READ | PROT_WRITE,
+                                MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+                        if (ret != (void*)segment.address)
+                        {
+                                LOG_ERROR("Cannot map segment @ 0x%lx: %s\n", segment.address, strerror(errno));
+                                close(fd);
+                                return -1;
+                        }
+                        compressed.push_back(&segment);
+                        mapped_bytes += segment.memory_length;
+                        stored_bytes += segment.stored_length;
+                        continue;
+                }
+
+                // Pages relocations never wrote stay shared with the page cache
+                if (segment.file_length > 0)
+                {
+                        void * ret = mmap((void*)segment.address, segment.file_length, segment.prot,
+                                MAP_PRIVATE | MAP_FIXED_NOREPLACE, fd, segment.file_offset);
+                        if (ret != (void*)segment.address)
+                        {
+                                LOG_ERROR("Cannot map segment @ 0x%lx: %s\n", segment.address, strerror(errno));
+                                close(fd);
+                                return -1;
+                        }
+                }
+                if (segment.memory_length > segment.file_length)
+                {
+                        uintptr_t address = segment.address + segment.file_length;
+                        void * ret = mmap((void*)address, segment.memory_length - segment.file_length, segment.prot,
+                                MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+                        if (ret != (void*)address)
+                        {
+                                LOG_ERROR("Cannot map zero pages @ 0x%lx: %s\n", address, strerror(errno));
+                                close(fd);
+                                return -1;
+                        }
+                }
+                mapped_bytes += segment.memory_length;
+                stored_bytes += segment.file_length;
+        }
+        close(fd);
+
+        // Blocks are independent: all of them, whatever their segment, are
+        // decompressed in place from the view on the pool
+        std::vector<Block> blocks;
+        int failures = 0;
+        for (const Segment * segment : compressed)
+        {
+                if (split_blocks(view + segment->file_offset, *segment, blocks) < 0)
+                {
+                        LOG_ERROR("Corrupted segment @ 0x%lx\n", segment->address);
+                        ++failures;
+                }
+        }
+
+        std::atomic<int> corrupted = 0;
+        auto decompress = [&](size_t k) {
+                if (decompress_block(blocks[k]) < 0)
+                {
+                        ++corrupted;
+                }
+        };
+        if (threads > 1 && blocks.size() > 1)
+        {
+                // Torn down before run(), programs may leave with SYS_exit
+                ThreadPool pool(threads);
+                pool.parallel_for(blocks.size(), decompress);
+        }
+        else
+        {
+                for (size_t k = 0; k < blocks.size(); ++k)
+                {
+                        decompress(k);
+                }
+        }
+        if (corrupted > 0)
+        {
+                LOG_ERROR("Cannot decompress %d block(s)\n", corrupted.load());
+                ++failures;
+        }
+
+        for (const Segment * segment : compressed)
+        {
+                if (mprotect((void*)segment->address, segment->memory_length, segment->prot) < 0)
+                {
+                        LOG_ERROR("Cannot protect segment @ 0x%lx: %s\n", segment->address, strerror(errno));
+                        ++failures;
+                }
+        }
+
+        if (view != nullptr)
+        {
+                munmap((void*)view, st.st_size);
+        }
+        if (failures > 0)
+        {
+                return -1;
+        }
+
+        entry = header.entry;
+        return 0;
+}
+
+int PackedImage::split_blocks(const char * stored, const Segment & segment, std::vector<Block> & blocks)
+{
+        const char * ip = stored;
+        const char * const end = stored + segment.stored_length;
+        char * op = (char *)segment.address;
+        char * const op_end = op + segment.file_length;
+
+        while (ip < end)
+        {
+                Block block;
+                if (end - ip < (long)sizeof(block.header)) return -1;
+                memcpy(&block.header, ip, sizeof(block.header));
+                ip += sizeof(block.header);
+                if (block.header.stored_length > (size_t)(end - ip) || block.header.raw_length > (size_t)(op_end - op)) return -1;
+
+                block.source = ip;
+                block.destination = op;
+                blocks.push_back(block);
+                ip += block.header.stored_length;
+                op += block.header.raw_length;
+        }
+        return op == op_end ? 0 : -1;
+}
+
+int PackedImage::decompress_block(const Block & block)
+{
+        if (block.header.stored_length == block.header.raw_length)
+        {
+                memcpy(block.destination, block.source, block.header.raw_length);
+                return 0;
+        }
+        return lz_decompress(block.source, block.header.stored_length, block.destination, block.header.raw_length) == block.header.raw_length ? 0 : -1;
+}
+
+int PackedImage::unmap()
+{
+        int ret = 0;
+        for (const auto & segment : segments)
+        {
+                ret |= munmap((void*)segment.address, segment.memory_length);
+        }
+        segments.clear();
+        mapped_bytes = 0;
+        stored_bytes = 0;
+        return ret;
+}
+
+int PackedImage::run()
+{
+        using Fun = int(*)(void);
+
+        Fun f = (Fun)(entry);
+        LOG_INFO("Jumping to entry %p ...\n", (void*)entry);
+        // The entry point may exit through a raw syscall, never flushing stdio
+        fflush(stdout);
+        int ret = f();
+        LOG_INFO("After jump\n");
+        return ret;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+// Self-contained image written by Packer: every object of a dependency graph,
+// relocated and bound at fixed addresses. Running it is mapping each segment
+// where it belongs and jumping to the entry point.
+//
+// Layout: Header, Segment table, then the segment data, each one page aligned.
+// Compressed segments are a sequence of blocks, a BlockHeader followed by at most
+// COMPRESSION_BLOCK bytes once decompressed (lz.h), or stored as is when that is smaller.
+struct PackedImage
+{
+        struct Header
+        {
+                char magic[8];
+                uint32_t version = 0;
+                uint32_t segment_count = 0;
+                uint64_t entry = 0;
+        };
+
+        struct Segment
+        {
+                uint64_t address = 0;           // page aligned
+                uint64_t memory_length = 0;     // page multiple
+                uint64_t file_length = 0;       // page multiple, the rest is zero filled
+                uint64_t file_offset = 0;
+                uint64_t stored_length = 0;     // bytes in the image, file_length unless compressed
+                uint32_t prot = 0;
+                uint32_t compression = 0;
+        };
+
+        enum Compression : uint32_t
+        {
+                NONE = 0,
+                LZ = 1,
+        };
+
+        struct BlockHeader
+        {
+                uint32_t stored_length = 0;     // == raw_length: the block is not compressed
+                uint32_t raw_length = 0;
+        };
+
+        static constexpr char MAGIC[8] = "BPPACK";
+        static constexpr uint32_t VERSION = 2;
+        static constexpr uint32_t COMPRESSION_BLOCK = 1 << 20;
+
+        // Compressed segments are decompressed on `threads` workers
+        int map(const std::filesystem::path & path, int threads = 1);
+        int unmap();
+        int run();
+
+        // A compressed block and where it goes once decompressed
+        struct Block
+        {
+                const char * source = nullptr;
+                char * destination = nullptr;
+                BlockHeader header;
+        };
+
+        // Appends the blocks of a compressed segment stored at `stored`, decompressed at its address
+        static int split_blocks(const char * stored, const Segment & segment, std::vector<Block> & blocks);
+        static int decompress_block(const Block & block);
+
+        uint64_t entry = 0;
+        uint64_t mapped_bytes = 0;
+        uint64_t stored_bytes = 0;
+        std::vector<Segment> segments;
+};
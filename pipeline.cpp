@@ -0,0 +1,297 @@
+#include "pipeline.h"
+#include "log.h"
+#include "relative_relocations.h"
+#include "trace.h"
+
+#include <cerrno>
+#include <cstring>
+#include <sys/stat.h>
+
+bool Pipeline::Event::Awaiter::await_suspend(std::coroutine_handle<> handle)
+{
+        std::lock_guard<std::mutex> lock(event.mutex_);
+        if (event.set_)
+        {
+                return false;
+        }
+        event.waiters_.emplace_back(handle, affinity);
+        return true;
+}
+
+void Pipeline::Event::set(ThreadPool & pool)
+{
+        std::vector<std::pair<std::coroutine_handle<>, size_t>> waiters;
+        {
+                std::lock_guard<std::mutex> lock(mutex_);
+                set_ = true;
+                waiters.swap(waiters_);
+        }
+        for (auto [handle, affinity] : waiters)
+        {
+                pool.submit([handle] { handle.resume(); }, affinity);
+        }
+}
+
+Pipeline::Pipeline(Process & process)
+        : process_(process)
+        , pool_(process.thread_pool())
+{
+}
+
+int Pipeline::run(const std::filesystem::path & path)
+{
+        if (!process_.objects_.empty() || process_.fixed_layout_)
+        {
+                LOG_ERROR("The pipeline only loads a program into an empty Process without a fixed layout\n");
+                return -1;
+        }
+
+        Trace::Scope scope("pipeline", path.c_str());
+        auto start = Process::Clock::now();
+        std::filesystem::path full_path;
+        if (process_.resolve_path(path, full_path) < 0)
+        {
+                return -1;
+        }
+        size_t search_paths = process_.search_paths_.size();
+        Node * root = nullptr;
+        {
+                std::lock_guard<std::mutex> lock(mutex_);
+                bool started = false;
+                root = add_node(full_path, started);
+                if (root == nullptr)
+                {
+                        return -1;
+                }
+                discovering_ = 1;
+        }
+        running_ = 1;
+        object(*root);
+
+        {
+                std::unique_lock<std::mutex> lock(done_mutex_);
+                done_.wait(lock, [this] { return running_ == 0; });
+        }
+
+        if (!failed_ && process_.apply_copy_relocations(0) < 0)
+        {
+                failed_ = true;
+        }
+        if (failed_)
+        {
+                process_.discard_objects(0);
+                process_.search_paths_.resize(search_paths);
+                return -1;
+        }
+        process_.relocated_objects_ = process_.objects_.size();
+        process_.stats_.pipeline_threads = pool_.size();
+        process_.stats_.pipeline_time = Process::Clock::now() - start;
+        return 0;
+}
+
+Pipeline::Job Pipeline::object(Node & node)
+{
+        co_await Schedule{pool_, node.affinity};
+
+        bool ok = process_.parse_object(node.path, node.obj) == 0 && discover(node) == 0 && process_.map_object(node.obj) == 0;
+        if (ok)
+        {
+                Trace::Scope scope("relocate relative", node.path.c_str());
+                auto start = Process::Clock::now();
+                const ElfFile & elf_file = node.obj.elf_file;
+                process_.stats_.relative_relocations += RelativeRelocations::apply_relr(node.obj.base(), elf_file.relr());
+                RelativeRelocations::apply_rela(node.obj.base(), elf_file.relative_relocations());
+                process_.stats_.relative_relocations += elf_file.relative_count();
+                node.relocation_time = Process::Clock::now() - start;
+        }
+        if (!ok)
+        {
+                failed_ = true;
+        }
+        arrive();
+
+        co_await symbols_ready_.wait(node.affinity);
+        if (ok && !failed_)
+        {
+                ok = relocate_symbols(node.index) == 0;
+        }
+        job_done(ok);
+}
+
+// Appends the RUNPATHs of `node` and starts a job for every dependency seen for the
+// first time. Search paths grow in discovery order, not in BFS order as with
+// load_object_and_dependencies: they only differ when two RUNPATHs disagree.
+int Pipeline::discover(Node & node)
+{
+        Trace::Scope scope("discover", node.path.c_str());
+        std::vector<Node *> started;
+        {
+                std::lock_guard<std::mutex> lock(mutex_);
+                process_.run_path_directories(node.obj, process_.search_paths_);
+                for (std::string_view name : node.obj.elf_file.get_dependencies())
+                {
+                        bool is_new = false;
+                        Node * dep = claim(name, is_new);
+                        if (dep == nullptr)
+                        {
+                                return -1;
+                        }
+                        node.needed.push_back(dep);
+                        if (is_new)
+                        {
+                                started.push_back(dep);
+                        }
+                }
+                discovering_ += started.size();
+        }
+        {
+                std::lock_guard<std::mutex> lock(done_mutex_);
+                running_ += started.size();
+        }
+        for (Node * dep : started)
+        {
+                object(*dep);
+        }
+        return 0;
+}
+
+// The node behind a NEEDED name, under mutex_
+Pipeline::Node * Pipeline::claim(std::string_view name, bool & started)
+{
+        auto seen = names_.find(name);
+        if (seen != names_.end())
+        {
+                ++process_.stats_.duplicate_names;
+                return seen->second;
+        }
+
+        auto start = Process::Clock::now();
+        std::filesystem::path full_path = name;
+        int ret = full_path.has_parent_path() ? 0
+                : process_.library_resolver_.resolve(std::string(name), process_.search_paths_, full_path);
+        process_.stats_.resolve_time += Process::Clock::now() - start;
+        if (ret < 0)
+        {
+                LOG_ERROR("Error cannot find file '%s'\n", std::string(name).c_str());
+                return nullptr;
+        }
+        Node * node = add_node(full_path, started);
+        if (node != nullptr)
+        {
+                names_.emplace(name, node);
+        }
+        return node;
+}
+
+// One node per file, whatever name or symlink led to it, under mutex_
+Pipeline::Node * Pipeline::add_node(const std::filesystem::path & full_path, bool & started)
+{
+        struct stat st;
+        if (stat(full_path.c_str(), &st) < 0)
+        {
+                LOG_ERROR("Cannot stat '%s': %s\n", full_path.c_str(), strerror(errno));
+                return nullptr;
+        }
+        Process::FileId id{st.st_dev, st.st_ino};
+        auto file = files_.find(id);
+        if (file != files_.end())
+        {
+                ++process_.stats_.duplicate_files;
+                return file->second;
+        }
+        Node & node = nodes_.emplace_back();
+        node.path = full_path;
+        node.id = id;
+        node.affinity = nodes_.size() - 1;
+        files_.emplace(id, &node);
+        started = true;
+        return &node;
+}
+
+// Every job arrives once: the last one knows the graph is complete
+void Pipeline::arrive()
+{
+        bool last = false;
+        {
+                std::lock_guard<std::mutex> lock(mutex_);
+                last = --discovering_ == 0;
+        }
+        if (last)
+        {
+                if (!failed_)
+                {
+                        finish_graph();
+                }
+                symbols_ready_.set(pool_);
+        }
+}
+
+// Moves the objects into objects_ in the BFS order of load_object_and_dependencies,
+// then builds the symbol table the symbolic relocations look names up in
+void Pipeline::finish_graph()
+{
+        Trace::Scope scope("pipeline graph");
+        std::vector<Node *> order{&nodes_.front()};
+        nodes_.front().index = 0;
+        for (size_t k = 0; k < order.size(); ++k)
+        {
+                for (Node * dep : order[k]->needed)
+                {
+                        if (dep->index < 0)
+                        {
+                                dep->index = order.size();
+                                order.push_back(dep);
+                        }
+                }
+        }
+
+        process_.stats_.relocation_times.assign(order.size(), {});
+        for (Node * node : order)
+        {
+                process_.loaded_files_[node->id] = node->index;
+                process_.stats_.pool_requests += node->obj.load_zone.pooled;
+                process_.stats_.pool_hits += node->obj.load_zone.recycled;
+                process_.stats_.relocation_times[node->index] = node->relocation_time;
+                process_.objects_.emplace_back(std::move(node->obj));
+        }
+        for (Node * node : order)
+        {
+                for (Node * dep : node->needed)
+                {
+                        process_.objects_[node->index].needed.push_back(dep->index);
+                        ++process_.objects_[dep->index].references;
+                }
+        }
+        if (process_.build_symbol_table(0) < 0)
+        {
+                failed_ = true;
+        }
+        process_.compute_closures(0);
+}
+
+int Pipeline::relocate_symbols(int index)
+{
+        const ElfFile & elf_file = process_.objects_[index].elf_file;
+        Trace::Scope scope("relocate symbols", process_.objects_[index].path.c_str());
+        auto start = Process::Clock::now();
+        if (process_.relocate_range(index, elf_file.relocations(), elf_file.relative_count(), elf_file.relocations().size()) < 0
+                || process_.apply_plt_relocations(index) < 0)
+        {
+                return -1;
+        }
+        process_.stats_.relocation_times[index] += Process::Clock::now() - start;
+        return 0;
+}
+
+void Pipeline::job_done(bool ok)
+{
+        if (!ok)
+        {
+                failed_ = true;
+        }
+        std::lock_guard<std::mutex> lock(done_mutex_);
+        if (--running_ == 0)
+        {
+                done_.notify_all();
+        }
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+#include "elf_object.h"
+#include "process.h"
+#include "thread_pool.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <coroutine>
+#include <cstddef>
+#include <deque>
+#include <filesystem>
+#include <mutex>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Loads and relocates a program with one coroutine per object on the Process pool:
+//
+//   resolve -> open and parse -> map -> RELATIVE and RELR -> | -> symbolic and PLT
+//
+// An object's dependencies are resolved and started as soon as it is parsed, and
+// its RELATIVE relocations only need its own base: they run while the rest of the
+// graph is still being opened. Symbols are looked up in load order, so the first
+// definition of an import may be in any object; the symbolic stage waits until the
+// whole graph is known and the symbol table is built. Startup costs the longest
+// chain of objects plus the symbolic relocations, not the sum of the phases.
+//
+// Only for a Process with nothing loaded yet, and not with a fixed layout, whose
+// addresses depend on the BFS order known at the end.
+class Pipeline
+{
+public:
+        // Workers when the Process is not given -j
+        static constexpr int DEFAULT_THREADS = 4;
+
+        explicit Pipeline(Process & process);
+
+        // load_object_and_dependencies and apply_relocations in one go, objects_ ends
+        // up in the same BFS order
+        int run(const std::filesystem::path & path);
+
+private:
+        // Detached coroutine, it resumes on the pool and owns nothing
+        struct Job
+        {
+                struct promise_type
+                {
+                        Job get_return_object() noexcept { return {}; }
+                        std::suspend_never initial_suspend() noexcept { return {}; }
+                        std::suspend_never final_suspend() noexcept { return {}; }
+                        void return_void() noexcept {}
+                        void unhandled_exception() noexcept { std::terminate(); }
+                };
+        };
+
+        // co_await moves the coroutine to the deque of worker `affinity`
+        struct Schedule
+        {
+                ThreadPool & pool;
+                size_t affinity;
+
+                bool await_ready() const noexcept { return false; }
+                void await_suspend(std::coroutine_handle<> handle)
+                {
+                        pool.submit([handle] { handle.resume(); }, affinity);
+                }
+                void await_resume() const noexcept {}
+        };
+
+        // Set once, then every waiter resumes on `pool`, with the affinity it waited with
+        class Event
+        {
+        public:
+                struct Awaiter
+                {
+                        Event & event;
+                        size_t affinity;
+
+                        bool await_ready() const noexcept { return false; }
+                        bool await_suspend(std::coroutine_handle<> handle);
+                        void await_resume() const noexcept {}
+                };
+
+                Awaiter wait(size_t affinity)
+                {
+                        return Awaiter{*this, affinity};
+                }
+
+                void set(ThreadPool & pool);
+
+        private:
+                std::mutex mutex_;
+                bool set_ = false;
+                std::vector<std::pair<std::coroutine_handle<>, size_t>> waiters_;
+        };
+
+        struct Node
+        {
+                std::filesystem::path path;
+                Process::FileId id;
+                ElfObject obj;
+                std::vector<Node *> needed;     // in DT_NEEDED order, duplicates included
+                size_t affinity = 0;            // in discovery order, every stage queued on one worker
+                int index = -1;                 // in objects_, once the graph is complete
+                Process::Clock::duration relocation_time {};
+        };
+
+        Job object(Node & node);
+        int discover(Node & node);
+        Node * claim(std::string_view name, bool & started);
+        Node * add_node(const std::filesystem::path & full_path, bool & started);
+        void arrive();
+        void finish_graph();
+        int relocate_symbols(int index);
+        void job_done(bool ok);
+
+        Process & process_;
+        ThreadPool & pool_;
+        Event symbols_ready_;
+
+        // Discovery, under mutex_
+        std::mutex mutex_;
+        std::deque<Node> nodes_;
+        std::unordered_map<std::string_view, Node *> names_;
+        std::unordered_map<Process::FileId, Node *, Process::FileIdHash> files_;
+        size_t discovering_ = 0;        // jobs started and not yet at the barrier
+        std::atomic<bool> failed_ = false;
+
+        // Completion, under done_mutex_
+        std::mutex done_mutex_;
+        std::condition_variable done_;
+        size_t running_ = 0;
+};
@@ -0,0 +1,60 @@
+#include "prefetcher.h"
+#include "log.h"
+#include "trace.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+Prefetcher::Prefetcher(ThreadPool & workers)
+        : workers_(workers)
+{
+}
+
+void Prefetcher::prefetch(const std::filesystem::path & path)
+{
+        {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (!seen_.insert(path.string()).second) return;
+                ++pending_;
+        }
+        workers_.submit([this, path] {
+                advise(path);
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (--pending_ == 0)
+                {
+                        done_.notify_all();
+                }
+        });
+}
+
+void Prefetcher::wait()
+{
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_.wait(lock, [this] { return pending_ == 0; });
+}
+
+void Prefetcher::advise(const std::filesystem::path & path)
+{
+        Trace::Scope scope("prefetch", path.c_str());
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) < 0 || posix_fadvise(fd, 0, st.st_size, POSIX_FADV_WILLNEED) != 0)
+        {
+                LOG_DEBUG("Cannot prefetch '%s': %s\n", path.c_str(), strerror(errno));
+                ++failures_;
+        }
+        else
+        {
+                ++files_;
+                bytes_ += st.st_size;
+        }
+        if (fd >= 0) close(fd);
+}
+
+Prefetcher::Stats Prefetcher::stats() const
+{
+        return Stats{files_.load(), bytes_.load(), failures_.load()};
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "thread_pool.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+
+// Starts reading files into the page cache from the workers of a pool: each file is
+// opened and posix_fadvise(WILLNEED)'d, which queues its read-ahead and returns.
+// Process hands it the dependencies of an object as soon as it is parsed, so that
+// the disk works while the object is mapped and its siblings are parsed.
+class Prefetcher
+{
+public:
+        struct Stats
+        {
+                size_t files = 0;
+                size_t bytes = 0;
+                size_t failures = 0;
+        };
+
+        explicit Prefetcher(ThreadPool & workers);
+
+        // Each file once
+        void prefetch(const std::filesystem::path & path);
+
+        // Until the advice queued so far is given, not until the reads are done
+        void wait();
+
+        Stats stats() const;
+
+private:
+        void advise(const std::filesystem::path & path);
+
+        std::mutex mutex_;
+        std::condition_variable done_;
+        size_t pending_ = 0;
+        std::unordered_set<std::string> seen_;
+        std::atomic<size_t> files_ = 0;
+        std::atomic<size_t> bytes_ = 0;
+        std::atomic<size_t> failures_ = 0;
+        ThreadPool & workers_;
+};
@@ -1,168 +1,1446 @@
 #include "process.h"
+#include "elf_utils.h"
+#include "log.h"
+#include "protection_planner.h"
+#include "relative_relocations.h"
+#include "trace.h"
 
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cerrno>
+#include <cstring>
 #include <filesystem>
+#include <numeric>
+#include <memory_resource>
 #include <queue>
+#include <sys/auxv.h>
+#include <sys/random.h>
 
+extern char ** environ;
+
+// Returns the index of the object behind `path`, which may have been loaded before
 int Process::load_object_and_dependencies(std::filesystem::path path)
 {
-        std::set<std::filesystem::path> deja_vu;
-        std::queue<std::filesystem::path> queue;
-        queue.push(path);
+        Trace::Scope scope("load", path.c_str());
+        size_t first = objects_.size();
+        if (prefetch_)
+        {
+                prefetcher_ = std::make_unique<Prefetcher>(thread_pool());
+        }
+        int root = jobs_ > 1 ? load_dependencies_parallel(path) : load_dependencies_serial(path);
+        if (prefetcher_)
+        {
+                prefetcher_->wait();
+                Prefetcher::Stats prefetched = prefetcher_->stats();
+                stats_.prefetched_files += prefetched.files;
+                stats_.prefetched_bytes += prefetched.bytes;
+                prefetcher_.reset();
+        }
+        if (root < 0 || build_symbol_table(first) < 0)
+        {
+                discard_objects(first);
+                return -1;
+        }
+        return root;
+}
+
+// Leaves the Process as it was before objects_[first] was loaded, the next load may succeed.
+// Nothing loaded before may point into what is discarded: they are never relocated again.
+void Process::discard_objects(size_t first)
+{
+        if (first >= objects_.size())
+        {
+                return;
+        }
+        // The survivors they needed lose these references
+        for (size_t i = first; i < objects_.size(); ++i)
+        {
+                for (int dep : objects_[i].needed)
+                {
+                        if (dep < (int)first)
+                        {
+                                --objects_[dep].references;
+                        }
+                }
+                for (int dep : objects_[i].bound)
+                {
+                        if (dep < (int)first)
+                        {
+                                --objects_[dep].references;
+                        }
+                }
+        }
+        objects_.resize(first);
+        for (auto & obj : objects_)
+        {
+                std::erase_if(obj.bound, [first](int dep) { return dep >= (int)first; });
+        }
+        std::erase_if(loaded_files_, [first](const auto & file) {
+                return file.second < 0 || file.second >= (int)first;
+        });
+        // Their indices are reused by the next load
+        for (auto & binding : lazy_bindings_)
+        {
+                if (binding.object >= (int)first)
+                {
+                        binding.object = -1;
+                }
+        }
+        relocated_objects_ = std::min(relocated_objects_, first);
+        protected_objects_ = std::min(protected_objects_, first);
+        build_symbol_table(0);
+}
+
+int Process::load_dependencies_serial(std::filesystem::path path)
+{
+        struct Pending
+        {
+                std::string_view name;
+                int parent;     // -1 for the root
+        };
+
+        // BFS bookkeeping, gone with the call
+        std::array<std::byte, SCRATCH_SIZE> buffer;
+        std::pmr::monotonic_buffer_resource scratch(buffer.data(), buffer.size());
+        std::pmr::unordered_map<std::string_view, FileId> deja_vu(&scratch);
+        std::queue<Pending, std::pmr::deque<Pending>> queue(std::pmr::deque<Pending>{&scratch});
+        queue.push(Pending{arena_.intern(path.native()), -1});
+        int root = -1;
 
         while (queue.size() > 0)
         {
-                std::filesystem::path current = queue.front();
+                Pending current = queue.front();
                 queue.pop();
-                if (deja_vu.count(current) > 0)
+                FileId id;
+                auto seen = deja_vu.find(current.name);
+                if (seen != deja_vu.end())
                 {
-                        continue;
+                        ++stats_.duplicate_names;
+                        id = seen->second;
                 }
-                deja_vu.insert(current);
-                int ret = load_object(current);
-                if (ret < 0)
+                else
                 {
-                        return -1;
+                        int ret = load_object(current.name, id);
+                        if (ret < 0)
+                        {
+                                return -1;
+                        }
+                        deja_vu.emplace(current.name, id);
+                        if (ret == 0)
+                        {
+                                int index = objects_.size() - 1;
+                                for (const auto & dep : objects_.back().elf_file.get_dependencies())
+                                {
+                                        queue.push(Pending{dep, index});
+                                }
+                        }
+                }
+                // Earlier names are loaded by now, BFS order
+                int index = loaded_files_.at(id);
+                if (current.parent < 0)
+                {
+                        root = index;
                 }
-                const auto & deps = objects_.back().elf_file.get_dependencies();
-                int deps_size = deps.size();
-                for (int i = 0; i < deps_size; ++i)
+                else
                 {
-                        queue.push(deps[i]);
+                        objects_[current.parent].needed.push_back(index);
+                        ++objects_[index].references;
                 }
         }
 
-        return 0;
+        return root;
 }
 
-int Process::load_object(std::filesystem::path path)
+// Same BFS as the serial loop, one frontier at a time: names are resolved against the
+// search paths known when the frontier starts, every object of the frontier is opened,
+// parsed and mapped on the pool, then they are appended to objects_ in BFS order
+int Process::load_dependencies_parallel(std::filesystem::path path)
 {
+        struct Pending
+        {
+                std::string_view name;
+                int parent;
+                FileId id {};
+        };
 
-        // Looking for the file in the different search paths
-        int ret = std::filesystem::exists(path) ? 0 : -1;
-        std::filesystem::path full_path = std::filesystem::absolute(path);
-        if (ret < 0)
+        ThreadPool & pool = thread_pool();
+
+        std::array<std::byte, SCRATCH_SIZE> buffer;
+        std::pmr::monotonic_buffer_resource scratch(buffer.data(), buffer.size());
+        std::pmr::unordered_map<std::string_view, FileId> deja_vu(&scratch);
+        std::pmr::vector<Pending> frontier({Pending{arena_.intern(path.native()), -1}}, &scratch);
+        int root = -1;
+
+        while (frontier.size() > 0)
         {
-                for (int i = 0; i < search_paths_.size(); ++i)
+                Trace::Scope scope("frontier");
+                std::vector<std::filesystem::path> full_paths;
+                std::vector<FileId> ids;
+                for (auto & pending : frontier)
                 {
-                        auto && tmp = search_paths_[i] / path;
-                        if (std::filesystem::exists(tmp))
+                        auto seen = deja_vu.find(pending.name);
+                        if (seen != deja_vu.end())
                         {
-                                ret = 0;
-                                full_path.swap(tmp);
-                                break;
+                                ++stats_.duplicate_names;
+                                pending.id = seen->second;
+                                continue;
+                        }
+
+                        std::filesystem::path full_path;
+                        if (resolve_path(pending.name, full_path) < 0)
+                        {
+                                return -1;
+                        }
+                        int ret = claim_file(full_path, pending.id);
+                        if (ret < 0)
+                        {
+                                return -1;
+                        }
+                        deja_vu.emplace(pending.name, pending.id);
+                        if (ret > 0)
+                        {
+                                full_paths.push_back(std::move(full_path));
+                                ids.push_back(pending.id);
                         }
                 }
+
+                std::vector<ElfObject> loaded(full_paths.size());
+                std::vector<int> results(full_paths.size(), 0);
+                // Each object is parsed and then mapped on the same worker, unless stolen
+                auto affinity = [](size_t k) { return k; };
+                pool.parallel_for(full_paths.size(), [&](size_t k) {
+                        results[k] = parse_object(full_paths[k], loaded[k]);
+                }, affinity);
+
+                // Addresses of a fixed layout only depend on the BFS order
+                for (size_t k = 0; k < loaded.size(); ++k)
+                {
+                        if (results[k] < 0)
+                        {
+                                return -1;
+                        }
+                        assign_fixed_base(loaded[k]);
+                        prefetch_dependencies(loaded[k]);
+                }
+
+                pool.parallel_for(full_paths.size(), [&](size_t k) {
+                        results[k] = map_object(loaded[k]);
+                }, affinity);
+
+                std::pmr::vector<Pending> next(&scratch);
+                for (size_t k = 0; k < loaded.size(); ++k)
+                {
+                        if (results[k] < 0)
+                        {
+                                return -1;
+                        }
+                        add_object(std::move(loaded[k]), ids[k]);
+                        int index = objects_.size() - 1;
+                        for (const auto & dep : objects_.back().elf_file.get_dependencies())
+                        {
+                                next.push_back(Pending{dep, index});
+                        }
+                }
+                // The whole frontier is loaded, whatever name reached each object
+                for (const auto & pending : frontier)
+                {
+                        int index = loaded_files_.at(pending.id);
+                        if (pending.parent < 0)
+                        {
+                                root = index;
+                        }
+                        else
+                        {
+                                objects_[pending.parent].needed.push_back(index);
+                                ++objects_[index].references;
+                        }
+                }
+                frontier = std::move(next);
+        }
+
+        return root;
+}
+
+void Process::retain_object(int index)
+{
+        ++objects_[index].references;
+}
+
+// Objects left without references are unmapped, every dependent before its dependencies,
+// and the survivors are compacted: remap gives the new index of every old one, -1 when
+// unloaded. A binding through the global symbol table to an object outside the DT_NEEDED
+// closure holds a reference too, as glibc's l_reldeps do, see add_binding_dependency.
+// Unlike dlclose, a cycle of such references stays loaded until the Process goes.
+int Process::release_object(int index, std::vector<int> & remap)
+{
+        remap.clear();
+        if (index < 0 || index >= (int)objects_.size() || objects_[index].references == 0)
+        {
+                LOG_ERROR("Process::release_object: object %d is not referenced\n", index);
+                return -1;
+        }
+        if (--objects_[index].references > 0)
+        {
+                return 0;
         }
+
+        Trace::Scope scope("unload", objects_[index].path.c_str());
+        std::vector<int> order{index};
+        for (size_t k = 0; k < order.size(); ++k)
+        {
+                for (const auto * deps : {&objects_[order[k]].needed, &objects_[order[k]].bound})
+                {
+                        for (int dep : *deps)
+                        {
+                                if (--objects_[dep].references == 0)
+                                {
+                                        order.push_back(dep);
+                                }
+                        }
+                }
+        }
+        // All of them before any is unmapped: a finalizer may still call into a dependency
+        for (int dead : order)
+        {
+                run_finalizers(dead);
+        }
+        remap.resize(objects_.size());
+        std::iota(remap.begin(), remap.end(), 0);
+        for (int dead : order)
+        {
+                LOG_DEBUG("Unloading '%s'\n", objects_[dead].path.c_str());
+                // Unmapped, or given back to the MappingPool, right here
+                ElfObject unloaded = std::move(objects_[dead]);
+                remap[dead] = -1;
+        }
+        stats_.objects_unloaded += order.size();
+
+        std::vector<ElfObject> survivors;
+        survivors.reserve(objects_.size() - order.size());
+        for (size_t i = 0; i < objects_.size(); ++i)
+        {
+                if (remap[i] < 0) continue;
+                remap[i] = survivors.size();
+                survivors.emplace_back(std::move(objects_[i]));
+        }
+        objects_ = std::move(survivors);
+        for (auto & obj : objects_)
+        {
+                for (int & dep : obj.needed)
+                {
+                        dep = remap[dep];
+                }
+                for (int & dep : obj.bound)
+                {
+                        dep = remap[dep];
+                }
+        }
+        compute_closures(0);
+        std::erase_if(loaded_files_, [&remap](const auto & file) {
+                return file.second < 0 || remap[file.second] < 0;
+        });
+        for (auto & file : loaded_files_)
+        {
+                file.second = remap[file.second];
+        }
+        for (auto & binding : lazy_bindings_)
+        {
+                binding.object = binding.object < 0 ? -1 : remap[binding.object];
+        }
+        if (stats_.relocation_times.size() == remap.size())
+        {
+                for (size_t i = 0; i < remap.size(); ++i)
+                {
+                        if (remap[i] >= 0)
+                        {
+                                stats_.relocation_times[remap[i]] = stats_.relocation_times[i];
+                        }
+                }
+                stats_.relocation_times.resize(objects_.size());
+        }
+        relocated_objects_ = std::min(relocated_objects_, objects_.size());
+        protected_objects_ = std::min(protected_objects_, objects_.size());
+        return build_symbol_table(0);
+}
+
+int Process::build_symbol_table(size_t first)
+{
+        if (first == 0)
+        {
+                symbol_table_.clear();
+        }
+        Trace::Scope scope("symbol table");
+        auto start = Clock::now();
+        int ret = symbol_table_.add(objects_, first);
+        stats_.symbol_table_build_time += Clock::now() - start;
+        return ret;
+}
+
+int Process::load_object(std::filesystem::path path, FileId & id)
+{
+        std::filesystem::path full_path;
+        int ret = resolve_path(path, full_path);
         if (ret < 0)
         {
-                printf("Error cannot find file '%s'\n", path.c_str());
                 return ret;
         }
+        ret = claim_file(full_path, id);
+        if (ret <= 0)
+        {
+                return ret < 0 ? ret : 1;
+        }
 
         ElfObject obj;
+        ret = parse_object(full_path, obj);
+        if (ret < 0)
+        {
+                return ret;
+        }
+        prefetch_dependencies(obj);
+
+        assign_fixed_base(obj);
+        ret = map_object(obj);
+        if (ret < 0)
+        {
+                return ret;
+        }
+
+        add_object(std::move(obj), id);
+        return 0;
+}
+
+int Process::resolve_path(const std::filesystem::path & path, std::filesystem::path & full_path)
+{
+        Trace::Scope scope("resolve", path.c_str());
+        auto start = Clock::now();
+        int ret = -1;
+        // The program itself, and names with a slash, are not searched for
+        if (objects_.empty() || path.has_parent_path())
+        {
+                ret = std::filesystem::exists(path) ? 0 : -1;
+                full_path = std::filesystem::absolute(path);
+        }
+        else
+        {
+                ret = library_resolver_.resolve(path.string(), search_paths_, full_path);
+        }
+        stats_.resolve_time += Clock::now() - start;
+        if (ret < 0)
+        {
+                LOG_ERROR("Error cannot find file '%s'\n", path.c_str());
+        }
+        return ret;
+}
+
+// Returns 1 the first time a file is seen, 0 when it is already loaded under another name
+int Process::claim_file(const std::filesystem::path & full_path, FileId & id)
+{
+        struct stat st;
+        if (stat(full_path.c_str(), &st) < 0)
+        {
+                LOG_ERROR("Cannot stat '%s': %s\n", full_path.c_str(), strerror(errno));
+                return -1;
+        }
+        id = FileId{st.st_dev, st.st_ino};
+        // The index is known once the object is added
+        if (!loaded_files_.emplace(id, -1).second)
+        {
+                LOG_DEBUG("'%s' is already loaded\n", full_path.c_str());
+                ++stats_.duplicate_files;
+                return 0;
+        }
+        return 1;
+}
+
+// parse_object and map_object do not touch the Process, they are safe to run
+// concurrently for different objects
+int Process::parse_object(const std::filesystem::path & full_path, ElfObject & obj) const
+{
+        Trace::Scope scope("parse", full_path.c_str());
         // Load the elf file into memory
-        ret = obj.load_and_parse_elf_file(full_path);
+        int ret = obj.load_and_parse_elf_file(full_path, arena_);
         if (ret < 0)
         {
-                printf("Error cannot loading object\n");
+                LOG_ERROR("Error cannot loading object\n");
                 return -1;
         }
+        obj.huge_text = huge_text_;
+        obj.pooled = mapping_pool_;
+        return 0;
+}
 
+int Process::map_object(ElfObject & obj) const
+{
+        Trace::Scope scope("map", obj.path.c_str());
         // Mapping load sections into memory
-        ret = obj.load();
+        int ret = obj.load(load_mode_);
         if (ret < 0)
         {
-                printf("Error mapping load sections of file '%s'\n", full_path.c_str());
+                LOG_ERROR("Error mapping load sections of file '%s'\n", obj.path.c_str());
                 return -1;
         }
+        return 0;
+}
+
+void Process::assign_fixed_base(ElfObject & obj)
+{
+        if (!fixed_layout_) return;
+
+        const uintptr_t page_mask = sysconf(_SC_PAGE_SIZE) - 1;
+        uintptr_t low = obj.convex_hull.first & ~page_mask;
+        uintptr_t high = (obj.convex_hull.second + page_mask) & ~page_mask;
+        // Slide the object so that its text starts on a huge page, the slot grows accordingly
+        uintptr_t text_vaddr = 0;
+        uintptr_t slide = 0;
+        if (obj.huge_text_vaddr(text_vaddr))
+        {
+                slide = (HugePages::SIZE - (text_vaddr - low) % HugePages::SIZE) % HugePages::SIZE;
+        }
+        obj.preferred_base = next_fixed_base_ + slide - low;
+        next_fixed_base_ += (slide + high - low + FIXED_LAYOUT_ALIGN - 1) & ~(FIXED_LAYOUT_ALIGN - 1);
+}
+
+bool Process::fixed_layout_honored() const
+{
+        return fixed_layout_ && std::all_of(objects_.begin(), objects_.end(), [](const ElfObject & obj) {
+                return obj.base() == obj.preferred_base;
+        });
+}
+
+void Process::add_object(ElfObject && obj, const FileId & id)
+{
+        loaded_files_[id] = objects_.size();
+        stats_.pool_requests += obj.load_zone.pooled;
+        stats_.pool_hits += obj.load_zone.recycled;
 
         // Add search_paths for future lookups
-        std::filesystem::path parent_path = full_path.parent_path();
-        auto & run_paths = obj.elf_file.run_paths();
-        for (const auto & rp : run_paths)
+        run_path_directories(obj, search_paths_);
+
+        objects_.emplace_back(std::move(obj));
+}
+
+void Process::run_path_directories(const ElfObject & obj, std::vector<std::filesystem::path> & directories) const
+{
+        for (const auto & rp : obj.elf_file.run_paths())
         {
                 if (rp == "$ORIGIN")
                 {
-                        search_paths_.emplace_back(parent_path);
+                        directories.emplace_back(obj.path.parent_path());
                 }
                 else
                 {
-                        search_paths_.emplace_back(rp);
+                        directories.emplace_back(rp);
                 }
         }
+}
 
-        obj.path = full_path;
-        objects_.emplace_back(std::move(obj));
+// Resolves the NEEDED names of `obj` against what the search paths will be once it
+// is added, quietly: a name that cannot be found fails later, when it is loaded
+void Process::prefetch_dependencies(const ElfObject & obj)
+{
+        if (!prefetcher_ || obj.elf_file.get_dependencies().empty()) return;
 
-        return 0;
+        Trace::Scope scope("prefetch dependencies", obj.path.c_str());
+        std::vector<std::filesystem::path> search_paths = search_paths_;
+        run_path_directories(obj, search_paths);
+        for (std::string_view name : obj.elf_file.get_dependencies())
+        {
+                std::filesystem::path full_path = name;
+                if (full_path.has_parent_path()
+                        || library_resolver_.resolve(std::string(name), search_paths, full_path) == 0)
+                {
+                        prefetcher_->prefetch(full_path);
+                }
+        }
+}
+
+ThreadPool & Process::thread_pool()
+{
+        if (!thread_pool_)
+        {
+                thread_pool_ = std::make_unique<ThreadPool>(jobs_);
+        }
+        return *thread_pool_;
 }
 
 int Process::adjust_permissions()
 {
-        for (int i = 0; i < objects_.size(); ++i)
+        Trace::Scope scope("protect");
+        ProtectionPlanner planner;
+        planner.plan(std::span<const ElfObject>(objects_).subspan(protected_objects_), load_mode_);
+        int ret = planner.apply();
+        if (ret == 0)
+        {
+                protected_objects_ = objects_.size();
+        }
+        stats_.protection_ranges = planner.ranges().size();
+        stats_.mprotect_calls = planner.syscalls();
+        return ret;
+}
+
+// DT_INIT then DT_INIT_ARRAY of objects_[first..], every dependency before its dependents
+// as ld.so orders them. Called with (argc, argv, envp) like glibc does, without arguments.
+void Process::run_initializers(size_t first)
+{
+        using Initializer = void (*)(int, char **, char **);
+        static char * no_arguments[] = {nullptr};
+        std::vector<int> order;
+        std::vector<bool> visited(objects_.size(), false);
+        // Depth first, an object after all its dependencies
+        std::vector<std::pair<int, size_t>> stack;
+        for (size_t root = first; root < objects_.size(); ++root)
+        {
+                if (visited[root]) continue;
+                visited[root] = true;
+                stack.emplace_back(root, 0);
+                while (!stack.empty())
+                {
+                        auto & [index, next] = stack.back();
+                        const std::vector<int> & needed = objects_[index].needed;
+                        if (next < needed.size())
+                        {
+                                int dep = needed[next++];
+                                if (dep >= (int)first && !visited[dep])
+                                {
+                                        visited[dep] = true;
+                                        stack.emplace_back(dep, 0);
+                                }
+                                continue;
+                        }
+                        order.push_back(index);
+                        stack.pop_back();
+                }
+        }
+
+        for (int index : order)
         {
-                objects_[i].set_final_map_protections();
+                ElfObject & obj = objects_[index];
+                const ElfFile::Initializers & initializers = obj.elf_file.initializers();
+                Trace::Scope scope("initialize", obj.path.c_str());
+                obj.initialized = true;
+                if (initializers.init != 0)
+                {
+                        ((Initializer)(obj.base() + initializers.init))(0, no_arguments, environ);
+                }
+                const Elf64_Addr * functions = (const Elf64_Addr *)(obj.base() + initializers.init_array);
+                for (size_t k = 0; k < initializers.init_array_count; ++k)
+                {
+                        // 0 and -1 are placeholders some linkers leave
+                        if (functions[k] != 0 && functions[k] != (Elf64_Addr)-1)
+                        {
+                                ((Initializer)functions[k])(0, no_arguments, environ);
+                        }
+                }
+        }
+}
+
+// DT_FINI_ARRAY backwards then DT_FINI, once, of an object whose initializers ran
+void Process::run_finalizers(int object_index)
+{
+        using Finalizer = void (*)();
+        ElfObject & obj = objects_[object_index];
+        if (!obj.initialized)
+        {
+                return;
+        }
+        obj.initialized = false;
+        const ElfFile::Initializers & initializers = obj.elf_file.initializers();
+        Trace::Scope scope("finalize", obj.path.c_str());
+        const Elf64_Addr * functions = (const Elf64_Addr *)(obj.base() + initializers.fini_array);
+        for (size_t k = initializers.fini_array_count; k-- > 0;)
+        {
+                if (functions[k] != 0 && functions[k] != (Elf64_Addr)-1)
+                {
+                        ((Finalizer)functions[k])();
+                }
+        }
+        if (initializers.fini != 0)
+        {
+                ((Finalizer)(obj.base() + initializers.fini))();
+        }
+}
+
+const elf64_sym* Process::lookup_symbol(const char * name, int skip, int & definer) const
+{
+        uint32_t hash = ElfFile::gnu_hash(name);
+        for (int j = 0; j < (int)objects_.size(); ++j)
+        {
+                if (j == skip) continue;
+                const elf64_sym* sym = objects_[j].elf_file.lookup(name, hash);
+                if (sym != nullptr)
+                {
+                        definer = j;
+                        return sym;
+                }
+        }
+        return nullptr;
+}
+
+int Process::symbol_address(int object_index, Elf64_Xword sym_index, uintptr_t & address)
+{
+        address = 0;
+        if (sym_index == STN_UNDEF)
+        {
+                return 0;
+        }
+
+        const ElfObject & obj = objects_[object_index];
+        if (sym_index >= obj.elf_file.dyn_symbols().size())
+        {
+                LOG_ERROR("Symbol index %lu out of the %zu dynamic symbols of '%s'\n", (unsigned long)sym_index,
+                        obj.elf_file.dyn_symbols().size(), obj.path.c_str());
+                return -1;
+        }
+        const elf64_sym* symbol = &obj.elf_file.dyn_symbols()[sym_index];
+        if (ELF64_ST_BIND(symbol->st_info) == STB_LOCAL)
+        {
+                address = obj.base() + symbol->st_value;
+                return 0;
+        }
+
+        const char * name = obj.elf_file.dt_name_from_index(symbol->st_name);
+        int definer = -1;
+        const elf64_sym* definition = nullptr;
+        ++stats_.symbol_lookups;
+        if (!symbol_table_.empty())
+        {
+                const SymbolTable::Entry * entry = symbol_table_.find(name, ElfFile::gnu_hash(name));
+                if (entry != nullptr)
+                {
+                        definition = entry->symbol;
+                        definer = entry->object;
+                }
         }
+        else
+        {
+                definition = lookup_symbol(name, -1, definer);
+        }
+        if (definition == nullptr)
+        {
+                if (ELF64_ST_BIND(symbol->st_info) == STB_WEAK)
+                {
+                        return 0;
+                }
+                LOG_ERROR("Undefined symbol '%s' in '%s'\n", name, obj.path.c_str());
+                return -1;
+        }
+        add_binding_dependency(object_index, definer);
+        address = objects_[definer].base() + definition->st_value;
         return 0;
 }
 
-int Process::apply_relocations()
+// Every object reachable from objects_[first...] through DT_NEEDED, computed before
+// relocating: symbol_address reads them from the workers
+void Process::compute_closures(size_t first)
 {
-        for (int i = 0; i < objects_.size(); ++i)
+        for (size_t i = first; i < objects_.size(); ++i)
         {
-                const std::vector<const elf64_rela*> & relocations = objects_[i].elf_file.relocations();
-                for (const auto & rela : relocations)
+                std::vector<bool> closure(objects_.size(), false);
+                std::vector<int> stack{(int)i};
+                closure[i] = true;
+                while (!stack.empty())
                 {
-                        Elf64_Xword sym_index = ELF64_R_SYM(rela->r_info);
-                        const elf64_sym* symbol = objects_[i].elf_file.dyn_symbols()[sym_index]; 
-                        uintptr_t sym_value = objects_[i].elf_file.symbol_value_from_index(sym_index);
-                        switch (ELF64_R_TYPE(rela->r_info))
+                        int current = stack.back();
+                        stack.pop_back();
+                        for (int dep : objects_[current].needed)
                         {
-                                case (None):
-                                        break;
-                                case (_64):
+                                if (!closure[dep])
                                 {
-                                        uintptr_t jump_addr = (uintptr_t)objects_[i].base() + sym_value;
-                                        memcpy((void*)(objects_[i].base() + rela->r_offset), &jump_addr, 8);
-                                        break;
+                                        closure[dep] = true;
+                                        stack.push_back(dep);
                                 }
-                                case (COPY):
-                                        for (int j = 0; j < objects_.size(); ++j)
-                                        {
-                                                if (j == i) continue;
-                                                for (const auto & sym : objects_[j].elf_file.dyn_symbols())
-                                                {
-                                                        if (strcmp(objects_[j].elf_file.dt_name_from_index(sym->st_name)
-                                                                , objects_[i].elf_file.dt_name_from_index(symbol->st_name)) == 0)
-                                                        {
-                                                                uintptr_t sym_location = sym->st_value;
-                                                                memcpy((void*)(objects_[i].base() + rela->r_offset), (void*)(objects_[j].base() + sym_location), sym->st_size);
-                                                                break;
-                                                        }
-                                                }
-                                        }
-                                        break;
-                                case (RELATIVE):
+                        }
+                }
+                objects_[i].closure = std::move(closure);
+        }
+}
+
+// Keeps `definer` loaded as long as objects_[i], when no DT_NEEDED chain already does:
+// its GOT now points into it
+void Process::add_binding_dependency(int i, int definer)
+{
+        const std::vector<bool> & closure = objects_[i].closure;
+        if (definer < (int)closure.size() && closure[definer])
+        {
+                return;
+        }
+        std::lock_guard<std::mutex> lock(bindings_mutex_);
+        std::vector<int> & bound = objects_[i].bound;
+        if (definer == i || std::find(bound.begin(), bound.end(), definer) != bound.end())
+        {
+                return;
+        }
+        bound.push_back(definer);
+        ++objects_[definer].references;
+        ++stats_.binding_dependencies;
+}
+
+int Process::apply_relocations()
+{
+        Trace::Scope scope("relocate");
+        auto start = Clock::now();
+        stats_.relocation_times.resize(objects_.size());
+        const int first = relocated_objects_;
+        compute_closures(first);
+
+        uint64_t cache_key = 0;
+        // Images are cached for a whole dependency graph, not for the objects loaded later
+        bool use_cache = relocation_cache_ != nullptr && first == 0;
+        if (use_cache && !fixed_layout_honored())
+        {
+                LOG_WARNING("Relocation cache disabled: objects are not at their fixed addresses\n");
+                use_cache = false;
+        }
+        if (use_cache && RelocationCache::compute_key(objects_, lazy_binding_, cache_key) < 0)
+        {
+                LOG_WARNING("Relocation cache disabled: no key for these files\n");
+                use_cache = false;
+        }
+        if (use_cache)
+        {
+                stats_.relocation_cache_key = cache_key;
+                Trace::Scope cache_scope("cache load");
+                int ret = relocation_cache_->load(cache_key, objects_);
+                if (ret < -1)
+                {
+                        return ret;
+                }
+                if (ret == 0)
+                {
+                        stats_.relocation_cache_hit = true;
+                        stats_.relocation_cache_bytes = relocation_cache_->bytes();
+                        // Only the pointers into bagpacker itself differ between runs
+                        for (int i = 0; i < (int)objects_.size(); ++i)
+                        {
+                                if (binds_lazily(i))
                                 {
-                                        uintptr_t to_relocate = (uintptr_t)objects_[i].base() + rela->r_addend;
-                                        memcpy((void*)(objects_[i].base() + rela->r_offset), (void*)(&to_relocate), 8); 
-                                        break;
+                                        install_lazy_trampoline(i);
                                 }
-                                case (PC32):
-                                case (GOT32):
-                                case (PLT32):
-                                case (GLOB_DAT):
-                                case (JUMP_SLOT):
-                                        printf("Relocation not implemented\n");
-                                        return -1;
+                        }
+                        relocated_objects_ = objects_.size();
+                        stats_.relocation_wall_time = Clock::now() - start;
+                        return 0;
+                }
+        }
+
+        int ret = jobs_ > 1 ? apply_relocations_parallel() : apply_relocations_serial();
+        if (ret < 0)
+        {
+                return ret;
+        }
+
+        if (apply_copy_relocations(first) < 0)
+        {
+                return -1;
+        }
+
+        if (use_cache)
+        {
+                Trace::Scope cache_scope("cache store");
+                if (relocation_cache_->store(cache_key, objects_) == 0)
+                {
+                        stats_.relocation_cache_bytes = relocation_cache_->bytes();
+                }
+        }
+
+        relocated_objects_ = objects_.size();
+        stats_.relocation_wall_time = Clock::now() - start;
+        return 0;
+}
+
+// COPY reads the definer's data, which must be fully relocated first
+int Process::apply_copy_relocations(size_t first)
+{
+        for (int i = (int)first; i < (int)objects_.size(); ++i)
+        {
+                Trace::Scope object_scope("copy relocations", objects_[i].path.c_str());
+                auto object_start = Clock::now();
+                for (const auto & rela : objects_[i].elf_file.relocations())
+                {
+                        if (ELF64_R_TYPE(rela.r_info) == COPY && apply_relocation(i, rela) < 0)
+                        {
+                                return -1;
+                        }
+                }
+                stats_.relocation_times[i] += Clock::now() - object_start;
+        }
+        return 0;
+}
+
+int Process::apply_relocations_serial()
+{
+        for (int i = relocated_objects_; i < (int)objects_.size(); ++i)
+        {
+                Trace::Scope scope("relocate object", objects_[i].path.c_str());
+                auto start = Clock::now();
+                const ElfFile & elf_file = objects_[i].elf_file;
+                apply_relr_relocations(i);
+                apply_relative_relocations(i, 0, elf_file.relative_count());
+                if (relocate_range(i, elf_file.relocations(), elf_file.relative_count(), elf_file.relocations().size()) < 0)
+                {
+                        return -1;
+                }
+                if (apply_plt_relocations(i) < 0)
+                {
+                        return -1;
+                }
+                stats_.relocation_times[i] += Clock::now() - start;
+        }
+        return 0;
+}
+
+// Objects are independent once the symbol table is built: every object, and every
+// RELOCATION_CHUNK entries of a large table, is one task on the pool, the tasks of
+// an object queued on the same worker
+int Process::apply_relocations_parallel()
+{
+        enum class Kind
+        {
+                Relr,
+                Relative,       // [begin, end) of the DT_RELACOUNT run
+                Symbolic,       // [begin, end) of the rest of DT_RELA
+                Plt,
+        };
+
+        struct Task
+        {
+                int object;
+                size_t begin;
+                size_t end;
+                Kind kind;
+        };
+
+        std::vector<Task> tasks;
+        for (int i = relocated_objects_; i < (int)objects_.size(); ++i)
+        {
+                const ElfFile & elf_file = objects_[i].elf_file;
+                if (!elf_file.relr().empty())
+                {
+                        tasks.push_back(Task{i, 0, 0, Kind::Relr});
+                }
+                size_t relative = elf_file.relative_count();
+                size_t count = elf_file.relocations().size();
+                for (size_t begin = 0; begin < relative; begin += RELOCATION_CHUNK)
+                {
+                        tasks.push_back(Task{i, begin, std::min(relative, begin + RELOCATION_CHUNK), Kind::Relative});
+                }
+                for (size_t begin = relative; begin < count; begin += RELOCATION_CHUNK)
+                {
+                        tasks.push_back(Task{i, begin, std::min(count, begin + RELOCATION_CHUNK), Kind::Symbolic});
+                }
+                tasks.push_back(Task{i, 0, 0, Kind::Plt});
+        }
+
+        std::vector<int> results(tasks.size(), 0);
+        std::vector<Clock::duration> times(tasks.size());
+        thread_pool().parallel_for(tasks.size(), [&](size_t k) {
+                const Task & task = tasks[k];
+                static constexpr const char * names[] = {"relocate relr", "relocate relative", "relocate chunk", "relocate plt"};
+                Trace::Scope scope(names[(int)task.kind], objects_[task.object].path.c_str());
+                auto start = Clock::now();
+                switch (task.kind)
+                {
+                        case Kind::Relr:
+                                apply_relr_relocations(task.object);
+                                break;
+                        case Kind::Relative:
+                                apply_relative_relocations(task.object, task.begin, task.end);
+                                break;
+                        case Kind::Symbolic:
+                                results[k] = relocate_range(task.object, objects_[task.object].elf_file.relocations(), task.begin, task.end);
+                                break;
+                        case Kind::Plt:
+                                results[k] = apply_plt_relocations(task.object);
+                                break;
+                }
+                times[k] = Clock::now() - start;
+        }, [&](size_t k) { return (size_t)tasks[k].object; });
+
+        for (size_t k = 0; k < tasks.size(); ++k)
+        {
+                if (results[k] < 0)
+                {
+                        return -1;
+                }
+                stats_.relocation_times[tasks[k].object] += times[k];
+        }
+        return 0;
+}
+
+void Process::apply_relr_relocations(int i)
+{
+        const ElfObject & obj = objects_[i];
+        stats_.relative_relocations += RelativeRelocations::apply_relr(obj.base(), obj.elf_file.relr());
+}
+
+void Process::apply_relative_relocations(int i, size_t begin, size_t end)
+{
+        const ElfObject & obj = objects_[i];
+        RelativeRelocations::apply_rela(obj.base(), obj.elf_file.relative_relocations().subspan(begin, end - begin));
+        stats_.relative_relocations += end - begin;
+}
+
+int Process::relocate_range(int i, std::span<const elf64_rela> relocations, size_t begin, size_t end)
+{
+        for (size_t k = begin; k < end; ++k)
+        {
+                const elf64_rela & rela = relocations[k];
+                if (ELF64_R_TYPE(rela.r_info) == COPY) continue;
+                if (apply_relocation(i, rela) < 0)
+                {
+                        return -1;
+                }
+        }
+        return 0;
+}
+
+int Process::apply_plt_relocations(int i)
+{
+        const ElfFile & elf_file = objects_[i].elf_file;
+        if (binds_lazily(i))
+        {
+                return setup_lazy_binding(i);
+        }
+        for (const auto & rela : elf_file.plt_relocations())
+        {
+                if (apply_relocation(i, rela) < 0)
+                {
+                        return -1;
+                }
+        }
+        return 0;
+}
 
+int Process::apply_relocation(int i, const elf64_rela & rela)
+{
+        if (LOG_ENABLED(Log::TRACE))
+        {
+                print_rela(rela);
+        }
+        Elf64_Xword sym_index = ELF64_R_SYM(rela.r_info);
+        switch (ELF64_R_TYPE(rela.r_info))
+        {
+                case (None):
+                        break;
+                case (_64):
+                {
+                        uintptr_t sym_address = 0;
+                        if (symbol_address(i, sym_index, sym_address) < 0)
+                        {
+                                return -1;
+                        }
+                        uintptr_t value = sym_address + rela.r_addend;
+                        memcpy((void*)(objects_[i].base() + rela.r_offset), &value, 8);
+                        break;
+                }
+                case (GLOB_DAT):
+                case (JUMP_SLOT):
+                {
+                        uintptr_t sym_address = 0;
+                        if (symbol_address(i, sym_index, sym_address) < 0)
+                        {
+                                return -1;
+                        }
+                        memcpy((void*)(objects_[i].base() + rela.r_offset), &sym_address, 8);
+                        if (ELF64_R_TYPE(rela.r_info) == JUMP_SLOT)
+                        {
+                                ++stats_.jump_slots_bound;
+                        }
+                        break;
+                }
+                case (COPY):
+                {
+                        if (sym_index == STN_UNDEF || sym_index >= objects_[i].elf_file.dyn_symbols().size())
+                        {
+                                LOG_ERROR("Invalid symbol index %lu for copy relocation in '%s'\n", (unsigned long)sym_index,
+                                        objects_[i].path.c_str());
+                                return -1;
+                        }
+                        const elf64_sym* symbol = &objects_[i].elf_file.dyn_symbols()[sym_index];
+                        const char * name = objects_[i].elf_file.dt_name_from_index(symbol->st_name);
+                        int definer = -1;
+                        const elf64_sym* source = nullptr;
+                        ++stats_.symbol_lookups;
+                        const SymbolTable::Entry * entry = symbol_table_.find(name, ElfFile::gnu_hash(name));
+                        if (entry != nullptr && (int)entry->object != i)
+                        {
+                                source = entry->symbol;
+                                definer = entry->object;
+                        }
+                        else
+                        {
+                                // The copy destination usually is the first definer, the source is the next one
+                                source = lookup_symbol(name, i, definer);
+                        }
+                        if (source == nullptr)
+                        {
+                                LOG_ERROR("Undefined symbol '%s' for copy relocation in '%s'\n", name, objects_[i].path.c_str());
+                                return -1;
                         }
+                        memcpy((void*)(objects_[i].base() + rela.r_offset), (void*)(objects_[definer].base() + source->st_value), source->st_size);
+                        break;
+                }
+                case (RELATIVE):
+                {
+                        uintptr_t to_relocate = (uintptr_t)objects_[i].base() + rela.r_addend;
+                        memcpy((void*)(objects_[i].base() + rela.r_offset), (void*)(&to_relocate), 8); 
+                        break;
                 }
+                case (PC32):
+                case (GOT32):
+                case (PLT32):
+                default:
+                        LOG_ERROR("Relocation type %lu not implemented in '%s'\n",
+                                (unsigned long)ELF64_R_TYPE(rela.r_info), objects_[i].path.c_str());
+                        return -1;
         }
         return 0;
 }
 
+int Process::setup_lazy_binding(int i)
+{
+        ElfObject & obj = objects_[i];
+        install_lazy_trampoline(i);
+
+        // Until bound, each slot points back at the push/jmp stub of its own PLT entry
+        for (const auto & rela : obj.elf_file.plt_relocations())
+        {
+                if (ELF64_R_TYPE(rela.r_info) != JUMP_SLOT)
+                {
+                        if (apply_relocation(i, rela) < 0)
+                        {
+                                return -1;
+                        }
+                        continue;
+                }
+                uintptr_t * slot = (uintptr_t *)(obj.base() + rela.r_offset);
+                *slot += obj.base();
+                ++stats_.jump_slots_deferred;
+        }
+        return 0;
+}
+
+bool Process::binds_lazily(int i) const
+{
+        const ElfFile & elf_file = objects_[i].elf_file;
+        return lazy_binding_ && !elf_file.bind_now() && elf_file.pltgot() != 0;
+}
+
+void Process::install_lazy_trampoline(int i)
+{
+        ElfObject & obj = objects_[i];
+        LazyBinding * binding = nullptr;
+        {
+                std::lock_guard<std::mutex> lock(lazy_bindings_mutex_);
+                binding = &lazy_bindings_.emplace_back(LazyBinding{this, i});
+        }
+
+        // GOT[0] is the link-time address of _DYNAMIC, PLT0 pushes GOT[1] and jumps to GOT[2]
+        uintptr_t * got = (uintptr_t *)(obj.base() + obj.elf_file.pltgot());
+        got[1] = (uintptr_t)binding;
+        got[2] = (uintptr_t)&bagpacker_plt_trampoline;
+}
+
+uintptr_t Process::bind_lazy_slot(int i, uint64_t reloc_index)
+{
+        if (i < 0 || i >= (int)objects_.size())
+        {
+                return 0;
+        }
+        std::span<const elf64_rela> plt_relocations = objects_[i].elf_file.plt_relocations();
+        if (reloc_index >= plt_relocations.size())
+        {
+                return 0;
+        }
+        const elf64_rela & rela = plt_relocations[reloc_index];
+        uintptr_t sym_address = 0;
+        if (symbol_address(i, ELF64_R_SYM(rela.r_info), sym_address) < 0)
+        {
+                return 0;
+        }
+        memcpy((void*)(objects_[i].base() + rela.r_offset), &sym_address, 8);
+        ++stats_.jump_slots_bound_lazily;
+        return sym_address;
+}
+
+// rsp = stack, rdx = 0 (no rtld_fini to register), then the entry as the kernel enters it
+extern "C" [[noreturn]] void bagpacker_enter(void * entry, void * stack);
+asm(R"(
+        .text
+        .globl bagpacker_enter
+        .type bagpacker_enter, @function
+bagpacker_enter:
+        movq %rsi, %rsp
+        xorl %edx, %edx
+        xorl %ebp, %ebp
+        jmp *%rdi
+        .size bagpacker_enter, .-bagpacker_enter
+)");
+
+void Process::start(const std::vector<std::string> & args, const std::vector<std::string> & env, void * stack, size_t stack_size)
+{
+        ElfObject & program = objects_[0];
+        const elf64_hdr & header = program.elf_file.elf_header();
+        const elf64_phdr * phdrs = program.elf_file.program_headers_table();
+        uintptr_t phdr_address = 0;
+        for (int i = 0; i < header.e_phnum; ++i)
+        {
+                if (phdrs[i].p_type == PT_PHDR)
+                {
+                        phdr_address = program.base() + phdrs[i].p_vaddr;
+                        break;
+                }
+                if (phdrs[i].p_type == PT_LOAD && header.e_phoff >= phdrs[i].p_offset
+                        && header.e_phoff < phdrs[i].p_offset + phdrs[i].p_filesz)
+                {
+                        phdr_address = program.base() + phdrs[i].p_vaddr + header.e_phoff - phdrs[i].p_offset;
+                }
+        }
+
+        // Strings first, at the top, then argc, argv, envp and auxv below them
+        uintptr_t top = (uintptr_t)stack + stack_size;
+        auto push_string = [&top](const std::string & string) {
+                top -= string.size() + 1;
+                memcpy((void*)top, string.c_str(), string.size() + 1);
+                return top;
+        };
+        std::vector<uintptr_t> argv;
+        std::vector<uintptr_t> envp;
+        for (const auto & arg : args)
+        {
+                argv.push_back(push_string(arg));
+        }
+        for (const auto & variable : env)
+        {
+                envp.push_back(push_string(variable));
+        }
+        uintptr_t execfn = push_string(program.path.string());
+        uintptr_t platform = push_string("x86_64");
+        top &= ~(uintptr_t)15;
+        top -= 16;
+        // AT_RANDOM seeds the stack protector canary and pointer guard
+        uintptr_t random = top;
+        if (getrandom((void*)random, 16, 0) != 16)
+        {
+                memset((void*)random, 0x5a, 16);
+        }
+
+        const std::pair<uint64_t, uint64_t> auxv[] = {
+                {AT_PHDR, phdr_address},
+                {AT_PHENT, header.e_phentsize},
+                {AT_PHNUM, header.e_phnum},
+                {AT_PAGESZ, (uint64_t)sysconf(_SC_PAGE_SIZE)},
+                {AT_BASE, 0},
+                {AT_FLAGS, 0},
+                {AT_ENTRY, (uint64_t)program.entry_point()},
+                {AT_UID, getuid()},
+                {AT_EUID, geteuid()},
+                {AT_GID, getgid()},
+                {AT_EGID, getegid()},
+                {AT_SECURE, 0},
+                {AT_RANDOM, random},
+                {AT_HWCAP, getauxval(AT_HWCAP)},
+                {AT_HWCAP2, getauxval(AT_HWCAP2)},
+                {AT_CLKTCK, getauxval(AT_CLKTCK)},
+                {AT_SYSINFO_EHDR, getauxval(AT_SYSINFO_EHDR)},
+                {AT_PLATFORM, platform},
+                {AT_EXECFN, execfn},
+                {AT_NULL, 0},
+        };
+        size_t words = 1 + argv.size() + 1 + envp.size() + 1 + 2 * std::size(auxv);
+        // rsp is 16 byte aligned on argc
+        uint64_t * sp = (uint64_t *)((top - words * 8) & ~(uintptr_t)15);
+        if ((uintptr_t)sp < (uintptr_t)stack + stack_size / 2)
+        {
+                LOG_ERROR("Arguments and environment do not fit on a %zu byte stack\n", stack_size);
+                _exit(127);
+        }
+        uint64_t * word = sp;
+        *word++ = argv.size();
+        for (uintptr_t arg : argv)
+        {
+                *word++ = arg;
+        }
+        *word++ = 0;
+        for (uintptr_t variable : envp)
+        {
+                *word++ = variable;
+        }
+        *word++ = 0;
+        for (const auto & [type, value] : auxv)
+        {
+                *word++ = type;
+                *word++ = value;
+        }
+
+        thread_pool_.reset();
+        void * entry = program.entry_point();
+        LOG_INFO("Entering %p with %zu arguments, stack @ %p\n", entry, args.size(), (void*)sp);
+        fflush(stdout);
+        bagpacker_enter(entry, sp);
+}
+
+// What building a std::vector of `count` entry pointers with push_back costs: the capacity
+// doubles from 1, the last buffer is what stays allocated
+static void pointer_vector_cost(size_t count, size_t & bytes, size_t & allocations)
+{
+        if (count == 0) return;
+        bytes += std::bit_ceil(count) * sizeof(void *);
+        allocations += std::bit_width(count - 1) + 1;
+}
+
+void Process::print_stats()
+{
+        using std::chrono::duration_cast;
+        using std::chrono::microseconds;
+        using std::chrono::nanoseconds;
+
+        // Replays every symbolic relocation through the global table and through the
+        // per-object walk to put a number on the difference
+        std::vector<const char *> names;
+        for (const auto & obj : objects_)
+        {
+                for (const auto & rela : obj.elf_file.relocations())
+                {
+                        Elf64_Xword sym_index = ELF64_R_SYM(rela.r_info);
+                        if (sym_index == STN_UNDEF || sym_index >= obj.elf_file.dyn_symbols().size()) continue;
+                        names.push_back(obj.elf_file.dt_name_from_index(obj.elf_file.dyn_symbols()[sym_index].st_name));
+                }
+        }
 
+        size_t found = 0;
+        auto start = Clock::now();
+        for (const char * name : names)
+        {
+                found += symbol_table_.find(name, ElfFile::gnu_hash(name)) != nullptr;
+        }
+        auto table_time = Clock::now() - start;
+
+        start = Clock::now();
+        for (const char * name : names)
+        {
+                int definer = -1;
+                found += lookup_symbol(name, -1, definer) != nullptr;
+        }
+        auto walk_time = Clock::now() - start;
+
+        printf("Stats {\n");
+        printf("\tobjects: %zu\n", objects_.size());
+        const LibraryResolver::Stats & resolver = library_resolver_.stats();
+        Arena::Stats arena = arena_.stats();
+        printf("\tarena: { allocations: %zu, bytes: %zu, heap_blocks: %zu, heap_bytes: %zu, strings: %zu, intern_hits: %zu }\n",
+                arena.allocations, arena.bytes, arena.blocks, arena.block_bytes, arena.strings, arena.intern_hits);
+        printf("\tduplicates_avoided: { names: %zu, files: %zu }\n", stats_.duplicate_names, stats_.duplicate_files);
+        printf("\tbinding_dependencies: %zu\n", stats_.binding_dependencies);
+        if (mapping_pool_)
+        {
+                MappingPool::Stats pool = MappingPool::stats();
+                printf("\tmapping_pool: { unloaded: %zu, requests: %zu, hits: %zu, hit_rate: %.2f, held: %zu bytes, evictions: %zu }\n",
+                        stats_.objects_unloaded, stats_.pool_requests, stats_.pool_hits,
+                        stats_.pool_requests > 0 ? (double)stats_.pool_hits / stats_.pool_requests : 0.0,
+                        pool.bytes, pool.evictions);
+        }
+        if (thread_pool_)
+        {
+                ThreadPool::Stats pool = thread_pool_->stats();
+                printf("\tscheduler: { threads: %d, tasks: %zu, steals: %zu, max_queue_depth: %zu, idle: %ld us }\n",
+                        pool.threads, pool.tasks, pool.steals, pool.max_queue_depth,
+                        (long)duration_cast<microseconds>(pool.idle_time).count());
+        }
+        if (stats_.pipeline_threads > 0)
+        {
+                printf("\tpipeline: { threads: %d, wall: %ld us }\n", stats_.pipeline_threads,
+                        (long)duration_cast<microseconds>(stats_.pipeline_time).count());
+        }
+        if (prefetch_)
+        {
+                printf("\tprefetch: { files: %zu, bytes: %zu }\n", stats_.prefetched_files, stats_.prefetched_bytes);
+        }
+        printf("\tlibrary_resolver: { lookups: %zu, directory_hits: %zu, ld_so_cache_hits: %zu, directories_listed: %zu, entries: %zu, ld_so_cache_entries: %zu, time: %ld us }\n",
+                resolver.lookups, resolver.directory_hits, resolver.cache_hits, resolver.directories_listed,
+                resolver.directory_entries, resolver.cache_entries,
+                (long)duration_cast<microseconds>(stats_.resolve_time).count());
+        printf("\tsymbol_table: { entries: %zu, slots: %zu, memory: %zu bytes, build: %ld us }\n",
+                symbol_table_.size(), symbol_table_.capacity(), symbol_table_.memory_bytes(),
+                (long)duration_cast<microseconds>(stats_.symbol_table_build_time).count());
+        // RELA, JMPREL and the dynamic symbols are spans over the file data, no longer pointer vectors
+        std::vector<std::pair<size_t, size_t>> views(objects_.size());
+        size_t view_bytes = 0;
+        size_t view_allocations = 0;
+        for (size_t i = 0; i < objects_.size(); ++i)
+        {
+                const ElfFile & elf_file = objects_[i].elf_file;
+                pointer_vector_cost(elf_file.relocations().size(), views[i].first, views[i].second);
+                pointer_vector_cost(elf_file.plt_relocations().size(), views[i].first, views[i].second);
+                pointer_vector_cost(elf_file.dyn_symbols().size(), views[i].first, views[i].second);
+                view_bytes += views[i].first;
+                view_allocations += views[i].second;
+        }
+        printf("\tentry_views: { heap_bytes_saved: %zu, allocations_saved: %zu }\n", view_bytes, view_allocations);
+        for (size_t i = 0; i < objects_.size(); ++i)
+        {
+                printf("\t\t- %s: { heap_bytes_saved: %zu, allocations_saved: %zu }\n", objects_[i].path.c_str(),
+                        views[i].first, views[i].second);
+        }
+        printf("\tsymbol_lookups: %zu\n", stats_.symbol_lookups.load());
+        printf("\tjump_slots: { bound: %zu, deferred: %zu, bound_lazily: %zu }\n",
+                stats_.jump_slots_bound.load(), stats_.jump_slots_deferred.load(), stats_.jump_slots_bound_lazily.load());
+        printf("\trelocations: { jobs: %d, wall: %ld us, relative: %zu (%s) }\n", jobs_,
+                (long)duration_cast<microseconds>(stats_.relocation_wall_time).count(),
+                stats_.relative_relocations.load(), RelativeRelocations::isa());
+        if (relocation_cache_)
+        {
+                printf("\trelocation_cache: { dir: %s, key: %016lx, hit: %s, bytes: %zu }\n",
+                        relocation_cache_->directory().c_str(), stats_.relocation_cache_key,
+                        stats_.relocation_cache_hit ? "yes" : "no", stats_.relocation_cache_bytes);
+        }
+        size_t segments = 0;
+        for (const auto & obj : objects_)
+        {
+                segments += std::count_if(obj.elf_file.load_zones().begin(), obj.elf_file.load_zones().end(),
+                        [](const ElfFile::LoadZone & zone) { return zone.length > 0; });
+        }
+        printf("\tprotections: { segments: %zu, ranges: %zu, mprotect_calls: %zu }\n",
+                segments, stats_.protection_ranges, stats_.mprotect_calls);
+        if (huge_text_ != HugePages::Backing::None)
+        {
+                size_t bytes = 0;
+                std::vector<size_t> pages(objects_.size());
+                for (size_t i = 0; i < objects_.size(); ++i)
+                {
+                        const ElfObject & obj = objects_[i];
+                        if (obj.huge_text_bytes == 0) continue;
+                        pages[i] = HugePages::count(obj.base() + obj.convex_hull.first, obj.base() + obj.convex_hull.second);
+                        bytes += obj.huge_text_bytes;
+                }
+                printf("\thuge_text: { asked: %s, bytes: %zu, huge_pages: %zu }\n", HugePages::name(huge_text_), bytes,
+                        std::accumulate(pages.begin(), pages.end(), size_t(0)));
+                for (size_t i = 0; i < objects_.size(); ++i)
+                {
+                        if (objects_[i].huge_text_bytes == 0) continue;
+                        printf("\t\t- %s: { backing: %s, bytes: %zu, huge_pages: %zu }\n", objects_[i].path.c_str(),
+                                HugePages::name(objects_[i].huge_text_backing), objects_[i].huge_text_bytes, pages[i]);
+                }
+        }
+        for (size_t i = 0; i < objects_.size() && i < stats_.relocation_times.size(); ++i)
+        {
+                const ElfObject & obj = objects_[i];
+                const uintptr_t page_mask = sysconf(_SC_PAGE_SIZE) - 1;
+                size_t vmas = ProtectionPlanner::count_vmas((obj.base() + obj.convex_hull.first) & ~page_mask,
+                        obj.base() + obj.convex_hull.second);
+                printf("\t\t- %s: { relocations: %zu, relacount: %zu, relr: %zu, plt: %zu, time: %ld us, vmas: %zu }\n", obj.path.c_str(),
+                        obj.elf_file.relocations().size(), obj.elf_file.relative_count(),
+                        obj.elf_file.relr().size(), obj.elf_file.plt_relocations().size(),
+                        (long)duration_cast<microseconds>(stats_.relocation_times[i]).count(), vmas);
+        }
+        printf("\tlookup_replay: { names: %zu, found: %zu, table: %ld ns, per_object_walk: %ld ns, speedup: %.1fx }\n",
+                names.size(), found,
+                (long)duration_cast<nanoseconds>(table_time).count(),
+                (long)duration_cast<nanoseconds>(walk_time).count(),
+                table_time.count() > 0 ? (double)walk_time.count() / table_time.count() : 0.0);
+        printf("}\n");
+}
 
 std::ostream& operator<<(std::ostream& os, const Process& process)
 {
@@ -1,44 +1,194 @@
 #pragma once
 
 #include "elf_object.h"
+#include "lazy_binding.h"
+#include "library_resolver.h"
+#include "log.h"
+#include "prefetcher.h"
+#include "relocation_cache.h"
+#include "symbol_table.h"
+#include "thread_pool.h"
 
+#include <atomic>
+#include <chrono>
+#include <deque>
 #include <filesystem>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <set>
+#include <sys/stat.h>
+#include <unordered_map>
 #include <vector>
 
 class Process
 {
 public:
+        using Clock = std::chrono::steady_clock;
 
-        Process()
+        // Identity of a loaded file, whatever name or symlink led to it
+        struct FileId
         {
-                search_paths_.emplace_back("/usr/lib/x86_64-linux-gnu/");
-        }
+                dev_t device = 0;
+                ino_t inode = 0;
+
+                bool operator==(const FileId &) const = default;
+        };
+
+        struct FileIdHash
+        {
+                size_t operator()(const FileId & id) const noexcept
+                {
+                        return std::hash<uint64_t>{}(id.inode * 0x9e3779b97f4a7c15ull ^ id.device);
+                }
+        };
+
+        struct Stats
+        {
+                Clock::duration resolve_time {};
+                size_t duplicate_names = 0;     // NEEDED names already seen
+                size_t duplicate_files = 0;     // new names resolving to an already loaded file
+                Clock::duration symbol_table_build_time {};
+                // Bumped from the relocation workers
+                std::atomic<size_t> symbol_lookups = 0;
+                std::atomic<size_t> relative_relocations = 0;       // RELR words and DT_RELACOUNT entries
+                std::atomic<size_t> jump_slots_bound = 0;           // bound while relocating
+                std::atomic<size_t> jump_slots_deferred = 0;        // left to the PLT trampoline
+                std::atomic<size_t> jump_slots_bound_lazily = 0;    // bound by the trampoline on first call
+
+                Clock::duration relocation_wall_time {};
+                std::vector<Clock::duration> relocation_times;      // per object, summed over chunks
+
+                uint64_t relocation_cache_key = 0;
+                bool relocation_cache_hit = false;
+                size_t relocation_cache_bytes = 0;
+
+                size_t protection_ranges = 0;
+                size_t mprotect_calls = 0;
+                size_t objects_unloaded = 0;
+                size_t pool_requests = 0;       // objects mapped through the MappingPool
+                size_t pool_hits = 0;           // ... into a range it had kept
+                size_t binding_dependencies = 0;        // references added by bindings outside the DT_NEEDED closure
+                size_t prefetched_files = 0;    // dependencies read ahead while their parent was mapped
+                size_t prefetched_bytes = 0;
+                int pipeline_threads = 0;       // set when loaded by a Pipeline
+                Clock::duration pipeline_time {};   // load and relocation, see Pipeline::run
+        };
+
+        // Relocation tables larger than this are split across workers
+        static constexpr size_t RELOCATION_CHUNK = 16384;
+        // Stack buffer of the BFS queue and name set of a load, the heap is used past it
+        static constexpr size_t SCRATCH_SIZE = 8192;
 
         int run()
         {
                 using Fun = int(*)(void);
 
+                // Programs may leave with SYS_exit, which only ends the calling thread
+                thread_pool_.reset();
+
                 void * entry = objects_[0].entry_point();
                 Fun f = (Fun)(entry);
 
-                printf("Jumping to entry %p ...\n", (void*)(entry));
+                LOG_INFO("Jumping to entry %p ...\n", (void*)(entry));
+                // The entry point may exit through a raw syscall, never flushing stdio
+                fflush(stdout);
                 int ret = f();
-                printf("After jump\n");
+                LOG_INFO("After jump\n");
                 return ret;
         }
 
+        // Enters objects_[0] like the kernel does, rsp on argc, argv, envp and an auxv
+        // built at the top of [stack, stack + stack_size); programs get their arguments
+        [[noreturn]] void start(const std::vector<std::string> & args, const std::vector<std::string> & env,
+                void * stack, size_t stack_size);
+
+        // Can be called again on a loaded Process: only the new objects are loaded, and
+        // then relocated and protected by the next apply_relocations/adjust_permissions
         int load_object_and_dependencies(std::filesystem::path path);
-        int load_object(std::filesystem::path path);
+        // Returns 1 when the file behind `path` is already loaded
+        int load_object(std::filesystem::path path, FileId & id);
+        void discard_objects(size_t first);
+        void retain_object(int index);
+        int release_object(int index, std::vector<int> & remap);
+        int load_dependencies_serial(std::filesystem::path path);
+        int load_dependencies_parallel(std::filesystem::path path);
+        int resolve_path(const std::filesystem::path & path, std::filesystem::path & full_path);
+        int claim_file(const std::filesystem::path & full_path, FileId & id);
+        int parse_object(const std::filesystem::path & full_path, ElfObject & obj) const;
+        int map_object(ElfObject & obj) const;
+        void assign_fixed_base(ElfObject & obj);
+        bool fixed_layout_honored() const;
+        void add_object(ElfObject && obj, const FileId & id);
+        void run_path_directories(const ElfObject & obj, std::vector<std::filesystem::path> & directories) const;
+        void prefetch_dependencies(const ElfObject & obj);
         int adjust_permissions();
+        void run_initializers(size_t first);
+        void run_finalizers(int object_index);
         int apply_relocations();
+        int apply_relocations_serial();
+        int apply_relocations_parallel();
+        int apply_copy_relocations(size_t first);
+        void apply_relr_relocations(int object_index);
+        void apply_relative_relocations(int object_index, size_t begin, size_t end);
+        int relocate_range(int object_index, std::span<const elf64_rela> relocations, size_t begin, size_t end);
+        int apply_plt_relocations(int object_index);
+        int apply_relocation(int object_index, const elf64_rela & rela);
+        bool binds_lazily(int object_index) const;
+        int setup_lazy_binding(int object_index);
+        void install_lazy_trampoline(int object_index);
+        uintptr_t bind_lazy_slot(int object_index, uint64_t reloc_index);
+
+        // First definition of `name` in load order, skipping objects_[skip]
+        const elf64_sym* lookup_symbol(const char * name, int skip, int & definer) const;
+        int symbol_address(int object_index, Elf64_Xword sym_index, uintptr_t & address);
+        void compute_closures(size_t first);
+        void add_binding_dependency(int object_index, int definer);
+        int build_symbol_table(size_t first);
+        ThreadPool & thread_pool();
+
+        void print_stats();
 
         friend std::ostream& operator<<(std::ostream& os, const Process& process);
 // private:
 
+        // Parse and resolve metadata of objects_, declared first to go last
+        mutable Arena arena_;
         std::vector<ElfObject> objects_;
+        // RUNPATH and $ORIGIN directories, ld.so.cache and the default ones come after
         std::vector<std::filesystem::path> search_paths_;
+        LibraryResolver library_resolver_;
+        // Index in objects_, -1 while loading
+        std::unordered_map<FileId, int, FileIdHash> loaded_files_;
+        // Objects loaded by earlier load_object_and_dependencies calls are done with
+        size_t relocated_objects_ = 0;
+        size_t protected_objects_ = 0;
+
+        ElfObject::LoadMode load_mode_ = ElfObject::LoadMode::Copy;
+        bool lazy_binding_ = false;
+        HugePages::Backing huge_text_ = HugePages::Backing::None;
+        // Objects are mapped through the MappingPool, see release_object
+        bool mapping_pool_ = false;
+        int jobs_ = 1;
+        // Dependencies are read ahead as soon as their parent is parsed, see Prefetcher
+        bool prefetch_ = false;
+
+        // Objects are mapped at the same addresses on every run, see FIXED_LAYOUT_BASE
+        bool fixed_layout_ = false;
+        uintptr_t next_fixed_base_ = FIXED_LAYOUT_BASE;
+        std::unique_ptr<RelocationCache> relocation_cache_;
+        // The scheduler of every parallel stage, jobs_ workers created on first use
+        std::unique_ptr<ThreadPool> thread_pool_;
+        // Only alive during load_object_and_dependencies
+        std::unique_ptr<Prefetcher> prefetcher_;
+        // Stable addresses, GOT[1] of lazily bound objects points in there
+        std::deque<LazyBinding> lazy_bindings_;
+        std::mutex lazy_bindings_mutex_;
+        // ElfObject::bound and the references it adds, grown from the relocation workers
+        std::mutex bindings_mutex_;
+
+        SymbolTable symbol_table_;
+        Stats stats_;
 
 };
\ No newline at end of file
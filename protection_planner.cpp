@@ -0,0 +1,122 @@
+#include "protection_planner.h"
+#include "log.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+void ProtectionPlanner::plan(std::span<const ElfObject> objects, ElfObject::LoadMode mode)
+{
+        const uintptr_t page_mask = sysconf(_SC_PAGE_SIZE) - 1;
+        // What loading left: segments are read-write, gaps too in a Copy hull
+        const int loaded_prot = PROT_READ | PROT_WRITE;
+        const int loaded_gap_prot = mode == ElfObject::LoadMode::Copy ? loaded_prot : PROT_NONE;
+
+        std::vector<const ElfObject *> sorted;
+        for (const auto & obj : objects)
+        {
+                sorted.push_back(&obj);
+        }
+        std::sort(sorted.begin(), sorted.end(), [](const ElfObject * a, const ElfObject * b) {
+                return a->base() < b->base();
+        });
+
+        ranges_.clear();
+        syscalls_ = 0;
+        for (const ElfObject * obj : sorted)
+        {
+                const auto & zones = obj->elf_file.load_zones();
+                uintptr_t low = (obj->base() + obj->convex_hull.first) & ~page_mask;
+                uintptr_t high = (obj->base() + obj->convex_hull.second + page_mask) & ~page_mask;
+
+                // Cut the reservation at every page a segment starts or ends on
+                std::vector<uintptr_t> cuts{low, high};
+                for (const auto & zone : zones)
+                {
+                        if (zone.length == 0) continue;
+                        cuts.push_back((obj->base() + zone.base) & ~page_mask);
+                        cuts.push_back((obj->base() + zone.base + zone.length + page_mask) & ~page_mask);
+                }
+                std::sort(cuts.begin(), cuts.end());
+                cuts.erase(std::unique(cuts.begin(), cuts.end()), cuts.end());
+
+                for (size_t k = 0; k + 1 < cuts.size(); ++k)
+                {
+                        uintptr_t start = cuts[k];
+                        uintptr_t end = cuts[k + 1];
+                        int prot = PROT_NONE;
+                        bool in_segment = false;
+                        for (const auto & zone : zones)
+                        {
+                                if (zone.length == 0) continue;
+                                uintptr_t zone_start = (obj->base() + zone.base) & ~page_mask;
+                                uintptr_t zone_end = (obj->base() + zone.base + zone.length + page_mask) & ~page_mask;
+                                if (zone_start < end && start < zone_end)
+                                {
+                                        prot |= zone.flags;
+                                        in_segment = true;
+                                }
+                        }
+                        add(start, end, prot, prot != (in_segment ? loaded_prot : loaded_gap_prot));
+                }
+        }
+}
+
+void ProtectionPlanner::add(uintptr_t start, uintptr_t end, int prot, bool needs_change)
+{
+        if (!ranges_.empty() && ranges_.back().end == start && ranges_.back().prot == prot)
+        {
+                ranges_.back().end = end;
+                ranges_.back().needs_change |= needs_change;
+                return;
+        }
+        ranges_.push_back(Range{start, end, prot, needs_change});
+}
+
+int ProtectionPlanner::apply()
+{
+        for (const auto & range : ranges_)
+        {
+                if (!range.needs_change) continue;
+                ++syscalls_;
+                if (mprotect((void*)range.start, range.end - range.start, range.prot) < 0)
+                {
+                        LOG_ERROR("Cannot protect 0x%lx...0x%lx: %s\n", range.start, range.end, strerror(errno));
+                        return -1;
+                }
+                LOG_DEBUG("Setting prot @ 0x%lx...0x%lx | %s%s%s\n", range.start, range.end,
+                        (range.prot & PROT_READ) ? "R" : ".",
+                        (range.prot & PROT_WRITE) ? "W" : ".",
+                        (range.prot & PROT_EXEC) ? "X" : ".");
+        }
+        return 0;
+}
+
+size_t ProtectionPlanner::count_vmas(uintptr_t start, uintptr_t end)
+{
+        FILE * maps = fopen("/proc/self/maps", "r");
+        if (maps == nullptr)
+        {
+                return 0;
+        }
+        size_t count = 0;
+        char line[512];
+        while (fgets(line, sizeof(line), maps) != nullptr)
+        {
+                uintptr_t vma_start = 0;
+                uintptr_t vma_end = 0;
+                if (sscanf(line, "%lx-%lx", &vma_start, &vma_end) == 2 && vma_start < end && start < vma_end)
+                {
+                        ++count;
+                }
+                // Long paths span several fgets
+                while (strchr(line, '\n') == nullptr && fgets(line, sizeof(line), maps) != nullptr)
+                {
+                }
+        }
+        fclose(maps);
+        return count;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "elf_object.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+// Final page protections of a whole Process, computed before any syscall.
+//
+// Every object's reservation is cut at page granularity: pages of a segment get
+// its p_flags, pages shared by two segments get both, the gaps between segments
+// are PROT_NONE guards. Neighbouring ranges with equal protections are merged,
+// across objects too, and ranges already mapped with their final protection by
+// the load mode are left alone, so apply() issues the fewest mprotect calls.
+class ProtectionPlanner
+{
+public:
+        struct Range
+        {
+                uintptr_t start = 0;
+                uintptr_t end = 0;
+                int prot = 0;
+                bool needs_change = false;      // mapped with another protection
+        };
+
+        void plan(std::span<const ElfObject> objects, ElfObject::LoadMode mode);
+        int apply();
+
+        const std::vector<Range> & ranges() const noexcept
+        {
+                return ranges_;
+        }
+
+        size_t syscalls() const noexcept
+        {
+                return syscalls_;
+        }
+
+        // Mappings of /proc/self/maps overlapping [start, end)
+        static size_t count_vmas(uintptr_t start, uintptr_t end);
+
+private:
+        void add(uintptr_t start, uintptr_t end, int prot, bool needs_change);
+
+private:
+        std::vector<Range> ranges_;
+        size_t syscalls_ = 0;
+};
@@ -0,0 +1,168 @@
+#include "relative_relocations.h"
+
+#include <immintrin.h>
+
+bool RelativeRelocations::has_avx2()
+{
+        static const bool avx2 = __builtin_cpu_supports("avx2");
+        return avx2;
+}
+
+const char * RelativeRelocations::isa()
+{
+        return has_avx2() ? "avx2" : "sse2";
+}
+
+size_t RelativeRelocations::apply_relr(uintptr_t base, std::span<const uint64_t> relr)
+{
+        return has_avx2() ? apply_relr_avx2(base, relr) : apply_relr_sse2(base, relr);
+}
+
+void RelativeRelocations::apply_rela(uintptr_t base, std::span<const elf64_rela> relocations)
+{
+        if (has_avx2())
+        {
+                apply_rela_avx2(base, relocations);
+        }
+        else
+        {
+                apply_rela_sse2(base, relocations);
+        }
+}
+
+// Both RELR kernels walk a bitmap LANES bits at a time: all set is one vector
+// add, anything else is done word by word
+size_t RelativeRelocations::apply_relr_sse2(uintptr_t base, std::span<const uint64_t> relr)
+{
+        const __m128i bases = _mm_set1_epi64x(base);
+        uint64_t * where = nullptr;
+        size_t count = 0;
+        for (uint64_t entry : relr)
+        {
+                if ((entry & 1) == 0)
+                {
+                        where = (uint64_t *)(base + entry);
+                        *where++ += base;
+                        ++count;
+                        continue;
+                }
+                uint64_t bits = entry >> 1;
+                for (uint64_t * word = where; bits != 0; bits >>= 2, word += 2)
+                {
+                        if ((bits & 3) == 3)
+                        {
+                                __m128i value = _mm_loadu_si128((const __m128i *)word);
+                                _mm_storeu_si128((__m128i *)word, _mm_add_epi64(value, bases));
+                                count += 2;
+                        }
+                        else if (bits & 3)
+                        {
+                                word[(bits & 1) ? 0 : 1] += base;
+                                ++count;
+                        }
+                }
+                where += 63;
+        }
+        return count;
+}
+
+__attribute__((target("avx2")))
+size_t RelativeRelocations::apply_relr_avx2(uintptr_t base, std::span<const uint64_t> relr)
+{
+        const __m256i bases = _mm256_set1_epi64x(base);
+        uint64_t * where = nullptr;
+        size_t count = 0;
+        for (uint64_t entry : relr)
+        {
+                if ((entry & 1) == 0)
+                {
+                        where = (uint64_t *)(base + entry);
+                        *where++ += base;
+                        ++count;
+                        continue;
+                }
+                uint64_t bits = entry >> 1;
+                for (uint64_t * word = where; bits != 0; bits >>= 4, word += 4)
+                {
+                        uint64_t lanes = bits & 0xf;
+                        if (lanes == 0xf)
+                        {
+                                __m256i value = _mm256_loadu_si256((const __m256i *)word);
+                                _mm256_storeu_si256((__m256i *)word, _mm256_add_epi64(value, bases));
+                                count += 4;
+                                continue;
+                        }
+                        for (int k = 0; lanes != 0; ++k, lanes >>= 1)
+                        {
+                                if (lanes & 1)
+                                {
+                                        word[k] += base;
+                                        ++count;
+                                }
+                        }
+                }
+                where += 63;
+        }
+        return count;
+}
+
+// Linkers sort RELATIVE entries by offset, most of them patch adjacent words
+// (vtables, GOT, pointer arrays): when LANES entries do, one vector store
+void RelativeRelocations::apply_rela_sse2(uintptr_t base, std::span<const elf64_rela> relocations)
+{
+        const __m128i bases = _mm_set1_epi64x(base);
+        size_t k = 0;
+        for (; k + 2 <= relocations.size(); k += 2)
+        {
+                const elf64_rela * rela = &relocations[k];
+                __m128i values = _mm_add_epi64(_mm_set_epi64x(rela[1].r_addend, rela[0].r_addend), bases);
+                if (rela[1].r_offset == rela[0].r_offset + 8)
+                {
+                        _mm_storeu_si128((__m128i *)(base + rela[0].r_offset), values);
+                }
+                else
+                {
+                        *(uint64_t *)(base + rela[0].r_offset) = base + rela[0].r_addend;
+                        *(uint64_t *)(base + rela[1].r_offset) = base + rela[1].r_addend;
+                }
+        }
+        for (; k < relocations.size(); ++k)
+        {
+                *(uint64_t *)(base + relocations[k].r_offset) = base + relocations[k].r_addend;
+        }
+}
+
+__attribute__((target("avx2")))
+void RelativeRelocations::apply_rela_avx2(uintptr_t base, std::span<const elf64_rela> relocations)
+{
+        static_assert(sizeof(elf64_rela) == 24);
+        const __m256i bases = _mm256_set1_epi64x(base);
+        // r_offset and r_addend of 4 consecutive entries, in 8 byte units
+        const __m256i strides = _mm256_setr_epi64x(0, 3, 6, 9);
+        const __m256i adjacent = _mm256_setr_epi64x(0, 8, 16, 24);
+        size_t k = 0;
+        for (; k + 4 <= relocations.size(); k += 4)
+        {
+                const elf64_rela * rela = &relocations[k];
+                __m256i offsets = _mm256_i64gather_epi64((const long long *)&rela->r_offset, strides, 8);
+                __m256i values = _mm256_add_epi64(_mm256_i64gather_epi64((const long long *)&rela->r_addend, strides, 8), bases);
+                __m256i expected = _mm256_add_epi64(_mm256_set1_epi64x(rela->r_offset), adjacent);
+                if (_mm256_movemask_epi8(_mm256_cmpeq_epi64(offsets, expected)) == -1)
+                {
+                        _mm256_storeu_si256((__m256i *)(base + rela->r_offset), values);
+                }
+                else
+                {
+                        alignas(32) uint64_t words[4];
+                        _mm256_store_si256((__m256i *)words, values);
+                        for (int lane = 0; lane < 4; ++lane)
+                        {
+                                *(uint64_t *)(base + rela[lane].r_offset) = words[lane];
+                        }
+                }
+        }
+        for (; k < relocations.size(); ++k)
+        {
+                *(uint64_t *)(base + relocations[k].r_offset) = base + relocations[k].r_addend;
+        }
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "elf_structures.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+// Kernels for the relocations that only add the load base: R_X86_64_RELATIVE
+// entries and DT_RELR, the bulk of the relocations of any PIE or library.
+// Runs of adjacent words are patched 4 at a time with AVX2 when the CPU has it,
+// 2 at a time with SSE2 otherwise.
+class RelativeRelocations
+{
+public:
+        // "avx2" or "sse2", whichever the kernels run with
+        static const char * isa();
+
+        // DT_RELR: an even entry is the offset of a word to relocate, an odd one is a
+        // bitmap of which of the next 63 words, after the last one relocated, also are.
+        // Returns the number of words relocated.
+        static size_t apply_relr(uintptr_t base, std::span<const uint64_t> relr);
+
+        // RELATIVE entries, the first DT_RELACOUNT ones of DT_RELA: *(base + r_offset) = base + r_addend
+        static void apply_rela(uintptr_t base, std::span<const elf64_rela> relocations);
+
+private:
+        static bool has_avx2();
+        static size_t apply_relr_sse2(uintptr_t base, std::span<const uint64_t> relr);
+        static size_t apply_relr_avx2(uintptr_t base, std::span<const uint64_t> relr);
+        static void apply_rela_sse2(uintptr_t base, std::span<const elf64_rela> relocations);
+        static void apply_rela_avx2(uintptr_t base, std::span<const elf64_rela> relocations);
+};
@@ -0,0 +1,219 @@
+#include "relocation_cache.h"
+#include "log.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+
+uint64_t mix(uint64_t h, uint64_t v)
+{
+        h ^= v;
+        h *= 0x9e3779b97f4a7c15ull;
+        return h ^ (h >> 32);
+}
+
+int write_all(int fd, const void * data, size_t size)
+{
+        const char * runner = (const char *)data;
+        while (size > 0)
+        {
+                ssize_t written = write(fd, runner, size);
+                if (written < 0)
+                {
+                        if (errno == EINTR) continue;
+                        return -1;
+                }
+                runner += written;
+                size -= written;
+        }
+        return 0;
+}
+
+}
+
+int RelocationCache::compute_key(const std::vector<ElfObject> & objects, uint64_t flags, uint64_t & key)
+{
+        key = mix(VERSION, flags);
+        for (const auto & obj : objects)
+        {
+                struct stat st;
+                if (fstat(obj.elf_file.fd(), &st) < 0)
+                {
+                        LOG_ERROR("Cannot stat '%s': %s\n", obj.path.c_str(), strerror(errno));
+                        return -1;
+                }
+                key = mix(key, st.st_dev);
+                key = mix(key, st.st_ino);
+                key = mix(key, st.st_size);
+                key = mix(key, st.st_mtim.tv_sec * 1000000000ull + st.st_mtim.tv_nsec);
+                key = mix(key, obj.base());
+        }
+        return 0;
+}
+
+std::filesystem::path RelocationCache::entry_path(uint64_t key) const
+{
+        char name[32];
+        snprintf(name, sizeof(name), "%016lx.bpc", key);
+        return directory_ / name;
+}
+
+std::vector<RelocationCache::Range> RelocationCache::relocated_ranges(const ElfObject & obj)
+{
+        const uintptr_t page_mask = sysconf(_SC_PAGE_SIZE) - 1;
+        std::vector<Range> ranges;
+        for (const auto & zone : obj.elf_file.load_zones())
+        {
+                if (zone.length == 0) continue;
+                if (!(zone.flags & PROT_WRITE) && !obj.elf_file.text_relocations()) continue;
+
+                uintptr_t start = (obj.base() + zone.base) & ~page_mask;
+                uintptr_t end = (obj.base() + zone.base + zone.length + page_mask) & ~page_mask;
+                ranges.push_back(Range{start, end - start, 0});
+        }
+
+        // Segments may share a page, each page is stored once
+        std::sort(ranges.begin(), ranges.end(), [](const Range & a, const Range & b) { return a.address < b.address; });
+        std::vector<Range> merged;
+        for (const auto & range : ranges)
+        {
+                if (!merged.empty() && merged.back().address + merged.back().length >= range.address)
+                {
+                        uint64_t end = std::max(merged.back().address + merged.back().length, range.address + range.length);
+                        merged.back().length = end - merged.back().address;
+                        continue;
+                }
+                merged.push_back(range);
+        }
+        return merged;
+}
+
+int RelocationCache::load(uint64_t key, const std::vector<ElfObject> & objects)
+{
+        bytes_ = 0;
+        std::filesystem::path path = entry_path(key);
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+                return 1;
+        }
+
+        Header header;
+        std::vector<Range> ranges;
+        int ret = -1;
+        if (pread(fd, &header, sizeof(header), 0) == sizeof(header)
+                && memcmp(header.magic, MAGIC, sizeof(MAGIC)) == 0
+                && header.version == VERSION
+                && header.key == key)
+        {
+                ranges.resize(header.range_count);
+                size_t size = ranges.size() * sizeof(Range);
+                if (pread(fd, ranges.data(), size, sizeof(header)) == (ssize_t)size)
+                {
+                        ret = 0;
+                }
+        }
+        if (ret < 0)
+        {
+                LOG_ERROR("Corrupted relocation cache entry '%s'\n", path.c_str());
+                close(fd);
+                return -1;
+        }
+
+        // Every range must land inside the reservation of an object, mapped where the key says
+        for (const auto & range : ranges)
+        {
+                bool inside = std::any_of(objects.begin(), objects.end(), [&](const ElfObject & obj) {
+                        return obj.load_zone.contains(range.address, range.length);
+                });
+                if (!inside)
+                {
+                        LOG_ERROR("Relocation cache entry '%s' does not match the layout\n", path.c_str());
+                        close(fd);
+                        return -1;
+                }
+        }
+
+        for (const auto & range : ranges)
+        {
+                void * mapped = mmap((void*)range.address, range.length, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_FIXED, fd, range.file_offset);
+                if (mapped == MAP_FAILED)
+                {
+                        // Part of the image may already be replaced, the process is unusable
+                        LOG_ERROR("Relocation cache: mmap @ 0x%lx: %s\n", range.address, strerror(errno));
+                        close(fd);
+                        return -2;
+                }
+                bytes_ += range.length;
+        }
+
+        close(fd);
+        return 0;
+}
+
+int RelocationCache::store(uint64_t key, const std::vector<ElfObject> & objects)
+{
+        bytes_ = 0;
+        std::error_code ec;
+        std::filesystem::create_directories(directory_, ec);
+
+        const uint64_t page_size = sysconf(_SC_PAGE_SIZE);
+        std::vector<Range> ranges;
+        for (const auto & obj : objects)
+        {
+                auto obj_ranges = relocated_ranges(obj);
+                ranges.insert(ranges.end(), obj_ranges.begin(), obj_ranges.end());
+        }
+
+        Header header;
+        memcpy(header.magic, MAGIC, sizeof(MAGIC));
+        header.version = VERSION;
+        header.range_count = ranges.size();
+        header.key = key;
+
+        // Data is page aligned in the file so hits can map it directly
+        uint64_t offset = (sizeof(header) + ranges.size() * sizeof(Range) + page_size - 1) & ~(page_size - 1);
+        for (auto & range : ranges)
+        {
+                range.file_offset = offset;
+                offset += range.length;
+        }
+
+        std::filesystem::path path = entry_path(key);
+        std::filesystem::path tmp_path = path;
+        tmp_path += "." + std::to_string(getpid()) + ".tmp";
+        int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0)
+        {
+                LOG_ERROR("Relocation cache: cannot create '%s': %s\n", tmp_path.c_str(), strerror(errno));
+                return -1;
+        }
+
+        int ret = write_all(fd, &header, sizeof(header));
+        ret |= write_all(fd, ranges.data(), ranges.size() * sizeof(Range));
+        for (const auto & range : ranges)
+        {
+                if (ret < 0) break;
+                ret |= pwrite(fd, (const void*)range.address, range.length, range.file_offset) == (ssize_t)range.length ? 0 : -1;
+                bytes_ += range.length;
+        }
+        ret |= close(fd);
+
+        // Readers only ever see complete entries
+        if (ret < 0 || rename(tmp_path.c_str(), path.c_str()) < 0)
+        {
+                LOG_ERROR("Relocation cache: cannot write '%s': %s\n", path.c_str(), strerror(errno));
+                unlink(tmp_path.c_str());
+                return -1;
+        }
+        return 0;
+}
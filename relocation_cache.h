@@ -0,0 +1,69 @@
+#pragma once
+
+#include "elf_object.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+// Prelink-style cache of relocated images.
+//
+// An entry holds the pages relocations write to (writable segments, every segment
+// for DT_TEXTREL objects) for one dependency graph mapped at one fixed layout.
+// The key hashes the identity of every file (device, inode, size and modification
+// time, as make or ccache's stat mode would), the base address of every object and
+// the binding mode, so a replaced or rewritten input lands on another entry. No
+// page of the files is read to compute it.
+// On a hit the pages are mapped MAP_PRIVATE over the objects and nothing is relocated.
+class RelocationCache
+{
+public:
+
+        struct Range
+        {
+                uint64_t address = 0;
+                uint64_t length = 0;
+                uint64_t file_offset = 0;
+        };
+
+        struct Header
+        {
+                char magic[8];
+                uint32_t version = 0;
+                uint32_t range_count = 0;
+                uint64_t key = 0;
+        };
+
+        static constexpr char MAGIC[8] = "BPRELOC";
+        static constexpr uint32_t VERSION = 2;
+
+        explicit RelocationCache(std::filesystem::path directory)
+                : directory_(std::move(directory))
+        {
+        }
+
+        // Returns -1 when a file cannot be stat'ed
+        static int compute_key(const std::vector<ElfObject> & objects, uint64_t flags, uint64_t & key);
+
+        // Returns 0 on a hit, 1 on a miss and < 0 when an entry exists but cannot be used
+        int load(uint64_t key, const std::vector<ElfObject> & objects);
+        int store(uint64_t key, const std::vector<ElfObject> & objects);
+
+        size_t bytes() const noexcept
+        {
+                return bytes_;
+        }
+
+        const std::filesystem::path & directory() const noexcept
+        {
+                return directory_;
+        }
+
+private:
+        static std::vector<Range> relocated_ranges(const ElfObject & obj);
+        std::filesystem::path entry_path(uint64_t key) const;
+
+private:
+        std::filesystem::path directory_;
+        size_t bytes_ = 0;      // mapped on the last hit or written by the last store
+};
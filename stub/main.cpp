@@ -0,0 +1,23 @@
+// Minimal runtime for images written by `bagpacker --pack`: map and jump.
+#include "../packed_image.h"
+
+#include <stdio.h>
+#include <algorithm>
+#include <thread>
+
+int main(int argc, char** argv)
+{
+	if (argc < 2)
+	{
+		printf("Usage: %s <packed image>\n", argv[0]);
+		return 1;
+	}
+
+	PackedImage image;
+	// Compressed segments are decompressed on every core
+	if (image.map(argv[1], std::max(1u, std::thread::hardware_concurrency())) < 0)
+	{
+		return 2;
+	}
+	return image.run();
+}
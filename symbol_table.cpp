@@ -0,0 +1,101 @@
+#include "symbol_table.h"
+#include "elf_object.h"
+
+#include <algorithm>
+#include <string.h>
+
+int SymbolTable::build(const std::vector<ElfObject> & objects)
+{
+        clear();
+        return add(objects, 0);
+}
+
+int SymbolTable::add(const std::vector<ElfObject> & objects, size_t first)
+{
+        size_t exported = size_;
+        for (size_t i = first; i < objects.size(); ++i)
+        {
+                exported += objects[i].elf_file.dyn_symbols().size();
+        }
+
+        // Load factor stays under 1/2 so probe sequences are short
+        size_t capacity = std::max<size_t>(16, entries_.size());
+        while (capacity < exported * 2)
+        {
+                capacity <<= 1;
+        }
+        if (capacity != entries_.size())
+        {
+                rehash(capacity);
+        }
+
+        for (uint32_t i = first; i < objects.size(); ++i)
+        {
+                const ElfFile & elf_file = objects[i].elf_file;
+                for (const elf64_sym & sym : elf_file.dyn_symbols())
+                {
+                        if (sym.st_shndx == SHN_UNDEF || ELF64_ST_BIND(sym.st_info) == STB_LOCAL)
+                        {
+                                continue;
+                        }
+                        const char * name = elf_file.dt_name_from_index(sym.st_name);
+                        insert(name, ElfFile::gnu_hash(name), &sym, i);
+                }
+        }
+        return 0;
+}
+
+// Names are unique in the table, reinserting them in any order keeps every first definer
+void SymbolTable::rehash(size_t capacity)
+{
+        std::vector<Entry> old(capacity, Entry{});
+        old.swap(entries_);
+        mask_ = capacity - 1;
+        size_ = 0;
+        for (const Entry & entry : old)
+        {
+                if (entry.name != nullptr)
+                {
+                        insert(entry.name, entry.hash, entry.symbol, entry.object);
+                }
+        }
+}
+
+bool SymbolTable::insert(const char * name, uint32_t hash, const elf64_sym * symbol, uint32_t object)
+{
+        for (size_t slot = hash & mask_;; slot = (slot + 1) & mask_)
+        {
+                Entry & entry = entries_[slot];
+                if (entry.name == nullptr)
+                {
+                        entry = Entry{name, symbol, hash, object};
+                        ++size_;
+                        return true;
+                }
+                if (entry.hash == hash && strcmp(entry.name, name) == 0)
+                {
+                        // Already defined by an object loaded earlier
+                        return false;
+                }
+        }
+}
+
+const SymbolTable::Entry* SymbolTable::find(const char * name, uint32_t hash) const
+{
+        if (size_ == 0)
+        {
+                return nullptr;
+        }
+        for (size_t slot = hash & mask_;; slot = (slot + 1) & mask_)
+        {
+                const Entry & entry = entries_[slot];
+                if (entry.name == nullptr)
+                {
+                        return nullptr;
+                }
+                if (entry.hash == hash && strcmp(entry.name, name) == 0)
+                {
+                        return &entry;
+                }
+        }
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "elf_structures.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct ElfObject;
+
+// Flat open-addressing table of every symbol exported by a Process.
+// Objects are inserted in load order and the first definer of a name wins,
+// which is the ELF interposition rule, so a lookup is a single probe sequence.
+class SymbolTable
+{
+public:
+
+        struct Entry
+        {
+                const char * name = nullptr;
+                const elf64_sym * symbol = nullptr;
+                uint32_t hash = 0;      // ElfFile::gnu_hash of name
+                uint32_t object = 0;    // index in Process::objects_
+        };
+
+        int build(const std::vector<ElfObject> & objects);
+        // Objects loaded after the table was built, they never override earlier definers
+        int add(const std::vector<ElfObject> & objects, size_t first);
+        const Entry* find(const char * name, uint32_t hash) const;
+
+        void clear()
+        {
+                entries_.clear();
+                size_ = 0;
+                mask_ = 0;
+        }
+
+        bool empty() const noexcept
+        {
+                return size_ == 0;
+        }
+
+        size_t size() const noexcept
+        {
+                return size_;
+        }
+
+        size_t capacity() const noexcept
+        {
+                return entries_.size();
+        }
+
+        size_t memory_bytes() const noexcept
+        {
+                return entries_.capacity() * sizeof(Entry);
+        }
+
+private:
+        void rehash(size_t capacity);
+        bool insert(const char * name, uint32_t hash, const elf64_sym * symbol, uint32_t object);
+
+private:
+        std::vector<Entry> entries_;
+        size_t size_ = 0;
+        size_t mask_ = 0;
+};
@@ -0,0 +1,245 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sched.h>
+#include <string>
+
+// Worker running on this thread, if any
+static thread_local const ThreadPool * current_pool = nullptr;
+static thread_local size_t current_worker = 0;
+
+ThreadPool::ThreadPool(int threads)
+{
+        if (threads < 1) threads = 1;
+        for (int i = 0; i < threads; ++i)
+        {
+                workers_.push_back(std::make_unique<Worker>());
+        }
+        for (int i = 0; i < threads; ++i)
+        {
+                workers_[i]->thread = std::thread([this, i] { worker_loop(i); });
+        }
+}
+
+ThreadPool::~ThreadPool()
+{
+        {
+                std::lock_guard<std::mutex> lock(mutex_);
+                stopping_ = true;
+        }
+        task_available_.notify_all();
+        for (auto & worker : workers_)
+        {
+                worker->thread.join();
+        }
+}
+
+void ThreadPool::submit(Task task, size_t affinity)
+{
+        size_t target = 0;
+        if (affinity != ANY)
+        {
+                target = affinity % workers_.size();
+        }
+        else if (current_pool == this)
+        {
+                target = current_worker;
+        }
+        else
+        {
+                target = next_++ % workers_.size();
+        }
+
+        ++pending_;
+        size_t depth = 0;
+        {
+                Worker & worker = *workers_[target];
+                std::lock_guard<std::mutex> lock(worker.mutex);
+                worker.tasks.push_back(std::move(task));
+                depth = ++queued_;
+        }
+        size_t max = max_queued_.load(std::memory_order_relaxed);
+        while (depth > max && !max_queued_.compare_exchange_weak(max, depth, std::memory_order_relaxed))
+        {
+        }
+        // Taken so that a worker cannot miss queued_ between its check and its sleep
+        {
+                std::lock_guard<std::mutex> lock(mutex_);
+        }
+        task_available_.notify_one();
+}
+
+void ThreadPool::wait()
+{
+        std::unique_lock<std::mutex> lock(mutex_);
+        all_done_.wait(lock, [this] { return pending_ == 0; });
+}
+
+void ThreadPool::parallel_for(size_t count, const std::function<void(size_t)> & f,
+        const std::function<size_t(size_t)> & affinity)
+{
+        struct Batch
+        {
+                std::mutex mutex;
+                std::condition_variable done;
+                size_t remaining;
+        };
+        Batch batch;
+        batch.remaining = count;
+        for (size_t i = 0; i < count; ++i)
+        {
+                submit([&f, &batch, i] {
+                        f(i);
+                        std::lock_guard<std::mutex> lock(batch.mutex);
+                        if (--batch.remaining == 0)
+                        {
+                                batch.done.notify_all();
+                        }
+                }, affinity ? affinity(i) : ANY);
+        }
+        std::unique_lock<std::mutex> lock(batch.mutex);
+        batch.done.wait(lock, [&batch] { return batch.remaining == 0; });
+}
+
+ThreadPool::Stats ThreadPool::stats() const
+{
+        Stats stats;
+        stats.threads = workers_.size();
+        stats.max_queue_depth = max_queued_;
+        for (const auto & worker : workers_)
+        {
+                stats.tasks += worker->tasks_run;
+                stats.steals += worker->steals;
+                stats.idle_time += Clock::duration(worker->idle.load());
+        }
+        return stats;
+}
+
+// Newest first: what a task just queued for itself is likely still in cache
+bool ThreadPool::pop(size_t index, Task & task)
+{
+        Worker & worker = *workers_[index];
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        if (worker.tasks.empty())
+        {
+                return false;
+        }
+        task = std::move(worker.tasks.back());
+        worker.tasks.pop_back();
+        --queued_;
+        return true;
+}
+
+// Oldest first, from the next workers round
+bool ThreadPool::steal(size_t index, Task & task)
+{
+        for (size_t k = 1; k < workers_.size(); ++k)
+        {
+                Worker & victim = *workers_[(index + k) % workers_.size()];
+                std::lock_guard<std::mutex> lock(victim.mutex);
+                if (!victim.tasks.empty())
+                {
+                        task = std::move(victim.tasks.front());
+                        victim.tasks.pop_front();
+                        --queued_;
+                        ++workers_[index]->steals;
+                        return true;
+                }
+        }
+        return false;
+}
+
+void ThreadPool::finish_task()
+{
+        if (--pending_ == 0)
+        {
+                std::lock_guard<std::mutex> lock(mutex_);
+                all_done_.notify_all();
+        }
+}
+
+void ThreadPool::worker_loop(size_t index)
+{
+        current_pool = this;
+        current_worker = index;
+        Worker & worker = *workers_[index];
+        for (;;)
+        {
+                Task task;
+                if (pop(index, task) || steal(index, task))
+                {
+                        task();
+                        ++worker.tasks_run;
+                        finish_task();
+                        continue;
+                }
+
+                std::unique_lock<std::mutex> lock(mutex_);
+                if (stopping_ && queued_ == 0)
+                {
+                        return;
+                }
+                auto start = Clock::now();
+                task_available_.wait(lock, [this] { return stopping_ || queued_ > 0; });
+                worker.idle += (Clock::now() - start).count();
+        }
+}
+
+// "max 100000" or "<quota> <period>" for cgroup v2, quota alone for cgroup v1
+static bool read_quota(const std::string & quota_file, const std::string & period_file, double & cpus)
+{
+        std::ifstream quota_stream(quota_file);
+        std::string quota;
+        long period = 0;
+        if (!(quota_stream >> quota))
+        {
+                return false;
+        }
+        if (period_file.empty())
+        {
+                quota_stream >> period;
+        }
+        else
+        {
+                std::ifstream(period_file) >> period;
+        }
+        if (quota == "max" || quota == "-1" || period <= 0)
+        {
+                return false;
+        }
+        cpus = std::stod(quota) / period;
+        return cpus > 0;
+}
+
+int ThreadPool::available_cpus()
+{
+        int cpus = std::max(1u, std::thread::hardware_concurrency());
+        cpu_set_t set;
+        if (sched_getaffinity(0, sizeof(set), &set) == 0)
+        {
+                cpus = CPU_COUNT(&set);
+        }
+
+        // cgroup v2: "0::/path" in /proc/self/cgroup, the root when in a cgroup namespace
+        std::string cgroup;
+        std::ifstream self("/proc/self/cgroup");
+        for (std::string line; std::getline(self, line);)
+        {
+                if (line.rfind("0::", 0) == 0)
+                {
+                        cgroup = line.substr(3);
+                }
+        }
+        double quota = 0;
+        if (read_quota("/sys/fs/cgroup" + cgroup + "/cpu.max", "", quota)
+                || read_quota("/sys/fs/cgroup/cpu.max", "", quota)
+                || read_quota("/sys/fs/cgroup/cpu/cpu.cfs_quota_us", "/sys/fs/cgroup/cpu/cpu.cfs_period_us", quota)
+                || read_quota("/sys/fs/cgroup/cpu,cpuacct/cpu.cfs_quota_us", "/sys/fs/cgroup/cpu,cpuacct/cpu.cfs_period_us", quota))
+        {
+                int limit = (int)quota;
+                if (limit < quota) ++limit;
+                cpus = std::min(cpus, limit);
+        }
+        return std::max(1, cpus);
+}
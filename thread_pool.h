@@ -0,0 +1,91 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of workers, each with its own deque of tasks: a worker runs the newest
+// task of its deque, and once empty steals the oldest of another's. Tasks submitted
+// from a worker stay on its deque, a task with an affinity goes to the deque of
+// worker `affinity % size()`, so that everything done for one object tends to run
+// on one core.
+class ThreadPool
+{
+public:
+        using Task = std::function<void()>;
+        using Clock = std::chrono::steady_clock;
+
+        static constexpr size_t ANY = (size_t)-1;
+
+        struct Stats
+        {
+                int threads = 0;
+                size_t tasks = 0;
+                size_t steals = 0;              // tasks run by another worker than the one they were queued on
+                size_t max_queue_depth = 0;     // most tasks queued at once, all deques together
+                Clock::duration idle_time {};   // summed over the workers
+        };
+
+        explicit ThreadPool(int threads);
+        ~ThreadPool();
+
+        ThreadPool(const ThreadPool &) = delete;
+        ThreadPool & operator=(const ThreadPool &) = delete;
+
+        void submit(Task task, size_t affinity = ANY);
+
+        // Blocks until every task submitted by anyone has run, for shutdown; not to be
+        // called from a worker
+        void wait();
+
+        // Runs f(0) ... f(count - 1) on the workers and waits for these only, not for
+        // the other tasks on the pool; task k on the deque of affinity(k) when given
+        void parallel_for(size_t count, const std::function<void(size_t)> & f,
+                const std::function<size_t(size_t)> & affinity = nullptr);
+
+        int size() const noexcept
+        {
+                return workers_.size();
+        }
+
+        Stats stats() const;
+
+        // CPUs this process may run on: the affinity mask, capped by the cgroup CPU
+        // quota (cpu.max, or cpu.cfs_quota_us with cgroup v1) rounded up
+        static int available_cpus();
+
+private:
+        struct Worker
+        {
+                std::mutex mutex;
+                std::deque<Task> tasks;
+                std::thread thread;
+                std::atomic<size_t> tasks_run = 0;
+                std::atomic<size_t> steals = 0;
+                std::atomic<Clock::rep> idle = 0;
+        };
+
+        void worker_loop(size_t index);
+        bool pop(size_t index, Task & task);
+        bool steal(size_t index, Task & task);
+        void finish_task();
+
+private:
+        std::vector<std::unique_ptr<Worker>> workers_;
+        std::atomic<size_t> next_ = 0;          // round robin of the tasks without an affinity
+        std::atomic<size_t> queued_ = 0;
+        std::atomic<size_t> max_queued_ = 0;
+        std::atomic<size_t> pending_ = 0;       // queued or running
+        // Sleeping workers and wait() block on these
+        std::mutex mutex_;
+        std::condition_variable task_available_;
+        std::condition_variable all_done_;
+        bool stopping_ = false;
+};
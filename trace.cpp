@@ -0,0 +1,138 @@
+#include "trace.h"
+#include "log.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+std::atomic<bool> Trace::enabled_ = false;
+size_t Trace::events_per_thread_ = Trace::DEFAULT_EVENTS_PER_THREAD;
+std::mutex Trace::buffers_mutex_;
+std::vector<std::unique_ptr<Trace::Buffer>> Trace::buffers_;
+
+static std::chrono::steady_clock::time_point trace_epoch;
+
+void Trace::enable(size_t events_per_thread)
+{
+        events_per_thread_ = std::max<size_t>(events_per_thread, 1);
+        trace_epoch = std::chrono::steady_clock::now();
+        enabled_.store(true);
+}
+
+uint64_t Trace::now() noexcept
+{
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - trace_epoch).count();
+}
+
+Trace::Buffer & Trace::thread_buffer()
+{
+        thread_local Buffer * buffer = nullptr;
+        if (buffer == nullptr)
+        {
+                auto owned = std::make_unique<Buffer>();
+                owned->events.resize(events_per_thread_);
+                std::lock_guard<std::mutex> lock(buffers_mutex_);
+                owned->thread = buffers_.size();
+                buffer = owned.get();
+                buffers_.push_back(std::move(owned));
+        }
+        return *buffer;
+}
+
+void Trace::Scope::begin(const char * name, const char * detail) noexcept
+{
+        event_.name = name;
+        if (detail != nullptr)
+        {
+                // Paths are shortened to their file name
+                const char * slash = strrchr(detail, '/');
+                strncpy(event_.detail, slash != nullptr ? slash + 1 : detail, sizeof(event_.detail) - 1);
+        }
+        event_.start = now();
+}
+
+void Trace::Scope::end() noexcept
+{
+        event_.end = now();
+        Buffer & buffer = thread_buffer();
+        buffer.events[buffer.recorded % buffer.events.size()] = event_;
+        ++buffer.recorded;
+}
+
+static void write_json_string(FILE * file, const char * s)
+{
+        fputc('"', file);
+        for (; *s != '\0'; ++s)
+        {
+                unsigned char c = *s;
+                if (c == '"' || c == '\\')
+                {
+                        fprintf(file, "\\%c", c);
+                }
+                else if (c < 0x20)
+                {
+                        fprintf(file, "\\u%04x", c);
+                }
+                else
+                {
+                        fputc(c, file);
+                }
+        }
+        fputc('"', file);
+}
+
+int Trace::write(const std::filesystem::path & path)
+{
+        FILE * file = fopen(path.c_str(), "w");
+        if (file == nullptr)
+        {
+                LOG_ERROR("Cannot write trace '%s': %s\n", path.c_str(), strerror(errno));
+                return -1;
+        }
+
+        std::lock_guard<std::mutex> lock(buffers_mutex_);
+        int pid = getpid();
+        size_t written = 0;
+        size_t dropped = 0;
+
+        fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+        fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":0,\"args\":{\"name\":\"bagpacker\"}}", pid);
+        for (const auto & buffer : buffers_)
+        {
+                fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"thread %d\"}}",
+                        pid, buffer->thread, buffer->thread);
+
+                size_t size = buffer->events.size();
+                size_t count = std::min(buffer->recorded, size);
+                size_t first = buffer->recorded - count;
+                dropped += first;
+                for (size_t k = first; k < buffer->recorded; ++k)
+                {
+                        const Event & event = buffer->events[k % size];
+                        fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"bagpacker\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f",
+                                event.name, pid, buffer->thread, event.start / 1e3, (event.end - event.start) / 1e3);
+                        if (event.detail[0] != '\0')
+                        {
+                                fprintf(file, ",\"args\":{\"object\":");
+                                write_json_string(file, event.detail);
+                                fputc('}', file);
+                        }
+                        fputc('}', file);
+                        ++written;
+                }
+        }
+        fprintf(file, "\n]}\n");
+
+        int ret = ferror(file) ? -1 : 0;
+        ret |= fclose(file);
+        if (ret < 0)
+        {
+                LOG_ERROR("Cannot write trace '%s'\n", path.c_str());
+                return -1;
+        }
+        LOG_INFO("Trace written to '%s': %zu events, %zu overwritten\n", path.c_str(), written, dropped);
+        return 0;
+}
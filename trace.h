@@ -0,0 +1,84 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Timeline of a run: Trace::Scope records how long a phase took on the calling
+// thread, Trace::write() dumps every recorded scope as Chrome trace events, to
+// be opened in chrome://tracing or ui.perfetto.dev.
+//
+// Each thread appends to its own ring buffer, the oldest events are overwritten
+// when it is full. Nothing is recorded, and scopes cost one load, until enable().
+class Trace
+{
+public:
+        struct Event
+        {
+                const char * name = nullptr;    // static string
+                char detail[56] = {};           // usually the object file name, truncated
+                uint64_t start = 0;             // ns since enable()
+                uint64_t end = 0;
+        };
+
+        class Scope
+        {
+        public:
+                explicit Scope(const char * name, const char * detail = nullptr) noexcept
+                {
+                        if (enabled_.load(std::memory_order_relaxed))
+                        {
+                                begin(name, detail);
+                        }
+                }
+
+                ~Scope()
+                {
+                        if (event_.name != nullptr)
+                        {
+                                end();
+                        }
+                }
+
+                Scope(const Scope &) = delete;
+                Scope & operator=(const Scope &) = delete;
+
+        private:
+                void begin(const char * name, const char * detail) noexcept;
+                void end() noexcept;
+
+                Event event_;
+        };
+
+        static constexpr size_t DEFAULT_EVENTS_PER_THREAD = 1 << 14;
+
+        static void enable(size_t events_per_thread = DEFAULT_EVENTS_PER_THREAD);
+        static bool enabled() noexcept
+        {
+                return enabled_.load(std::memory_order_relaxed);
+        }
+
+        // Must not race with running scopes: call it once the workers are idle
+        static int write(const std::filesystem::path & path);
+
+private:
+        struct Buffer
+        {
+                std::vector<Event> events;
+                size_t recorded = 0;    // events[recorded % size] is the next slot
+                int thread = 0;
+        };
+
+        static uint64_t now() noexcept;
+        static Buffer & thread_buffer();
+
+        static std::atomic<bool> enabled_;
+        static size_t events_per_thread_;
+        static std::mutex buffers_mutex_;
+        // Owned here so events outlive the threads that recorded them
+        static std::vector<std::unique_ptr<Buffer>> buffers_;
+};
@@ -0,0 +1,297 @@
+#include "zygote.h"
+#include "log.h"
+#include "process.h"
+#include "trace.h"
+
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <unordered_map>
+
+extern char ** environ;
+
+static int read_all(int fd, void * buffer, size_t size)
+{
+        char * bytes = (char *)buffer;
+        while (size > 0)
+        {
+                ssize_t ret = read(fd, bytes, size);
+                if (ret < 0 && errno == EINTR) continue;
+                if (ret <= 0) return -1;
+                bytes += ret;
+                size -= ret;
+        }
+        return 0;
+}
+
+static int write_all(int fd, const void * buffer, size_t size)
+{
+        const char * bytes = (const char *)buffer;
+        while (size > 0)
+        {
+                ssize_t ret = send(fd, bytes, size, MSG_NOSIGNAL);
+                if (ret < 0 && errno == EINTR) continue;
+                if (ret <= 0) return -1;
+                bytes += ret;
+                size -= ret;
+        }
+        return 0;
+}
+
+static int socket_address(const std::filesystem::path & socket_path, sockaddr_un & address)
+{
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if (socket_path.string().size() >= sizeof(address.sun_path))
+        {
+                LOG_ERROR("Socket path '%s' is too long\n", socket_path.c_str());
+                return -1;
+        }
+        strcpy(address.sun_path, socket_path.c_str());
+        return 0;
+}
+
+int Zygote::serve(Process & process, const std::filesystem::path & socket_path)
+{
+        sockaddr_un address;
+        if (socket_address(socket_path, address) < 0)
+        {
+                return -1;
+        }
+        int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        unlink(socket_path.c_str());
+        if (listener < 0 || bind(listener, (sockaddr *)&address, sizeof(address)) < 0 || listen(listener, 128) < 0)
+        {
+                LOG_ERROR("Cannot listen on '%s': %s\n", socket_path.c_str(), strerror(errno));
+                return -1;
+        }
+
+        // Mapped once: every child gets it copy-on-write, untouched
+        void * stack = mmap(nullptr, STACK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+        if (stack == MAP_FAILED)
+        {
+                LOG_ERROR("Cannot map the launch stack: %s\n", strerror(errno));
+                return -1;
+        }
+
+        // Children are reaped from the poll loop, their status goes back to the client
+        sigset_t children;
+        sigset_t saved_mask;
+        sigemptyset(&children);
+        sigaddset(&children, SIGCHLD);
+        sigprocmask(SIG_BLOCK, &children, &saved_mask);
+        int signals = signalfd(-1, &children, SFD_CLOEXEC | SFD_NONBLOCK);
+        if (signals < 0)
+        {
+                LOG_ERROR("signalfd: %s\n", strerror(errno));
+                return -1;
+        }
+
+        // Programs may leave with SYS_exit, which only ends the calling thread
+        process.thread_pool_.reset();
+        std::unordered_map<pid_t, int> running;     // child -> client connection
+        LOG_INFO("Zygote for '%s' listening on '%s'\n", process.objects_[0].path.c_str(), socket_path.c_str());
+        fflush(stdout);
+
+        for (;;)
+        {
+                pollfd fds[2] = {{listener, POLLIN, 0}, {signals, POLLIN, 0}};
+                if (poll(fds, 2, -1) < 0)
+                {
+                        if (errno == EINTR) continue;
+                        LOG_ERROR("poll: %s\n", strerror(errno));
+                        return -1;
+                }
+
+                if (fds[1].revents & POLLIN)
+                {
+                        signalfd_siginfo info;
+                        while (read(signals, &info, sizeof(info)) == sizeof(info))
+                        {
+                        }
+                        int status = 0;
+                        pid_t pid = 0;
+                        while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+                        {
+                                auto child = running.find(pid);
+                                if (child == running.end()) continue;
+                                int32_t reply = status;
+                                write_all(child->second, &reply, sizeof(reply));
+                                close(child->second);
+                                running.erase(child);
+                        }
+                }
+
+                if (fds[0].revents & POLLIN)
+                {
+                        int connection = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+                        if (connection < 0) continue;
+                        // The request is read in this loop: a stalled client must not hold every other launch
+                        timeval timeout = {REQUEST_TIMEOUT_MS / 1000, REQUEST_TIMEOUT_MS % 1000 * 1000};
+                        setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+                        pid_t pid = spawn(process, connection, {listener, signals}, &saved_mask, stack);
+                        int32_t reply = pid;
+                        if (pid < 0 || write_all(connection, &reply, sizeof(reply)) < 0)
+                        {
+                                close(connection);
+                                continue;
+                        }
+                        running[pid] = connection;
+                }
+        }
+}
+
+// Reads one request and forks the child running it, -1 on a malformed request
+pid_t Zygote::spawn(Process & process, int connection, std::initializer_list<int> server_fds, const sigset_t * mask, void * stack)
+{
+        Header header;
+        iovec iov = {&header, sizeof(header)};
+        alignas(cmsghdr) char control[CMSG_SPACE(3 * sizeof(int))];
+        msghdr message = {};
+        message.msg_iov = &iov;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+        if (recvmsg(connection, &message, MSG_WAITALL | MSG_CMSG_CLOEXEC) != sizeof(header))
+        {
+                LOG_WARNING("Zygote: truncated request\n");
+                return -1;
+        }
+        int stdio[3] = {-1, -1, -1};
+        cmsghdr * cmsg = CMSG_FIRSTHDR(&message);
+        if (cmsg != nullptr && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS
+                && cmsg->cmsg_len == CMSG_LEN(3 * sizeof(int)))
+        {
+                memcpy(stdio, CMSG_DATA(cmsg), sizeof(stdio));
+        }
+
+        std::vector<char> payload;
+        std::vector<std::string> strings;
+        if (header.size > MAX_REQUEST)
+        {
+                LOG_WARNING("Zygote: request of %u bytes, the limit is %zu\n", header.size, MAX_REQUEST);
+        }
+        else
+        {
+                payload.resize(header.size);
+                if (read_all(connection, payload.data(), payload.size()) == 0)
+                {
+                        for (size_t k = 0; k < payload.size(); k += strings.back().size() + 1)
+                        {
+                                strings.emplace_back(&payload[k], strnlen(&payload[k], payload.size() - k));
+                        }
+                }
+        }
+        if (strings.size() != (size_t)header.arguments + header.variables)
+        {
+                LOG_WARNING("Zygote: malformed request\n");
+                for (int fd : stdio)
+                {
+                        if (fd >= 0) close(fd);
+                }
+                return -1;
+        }
+        std::vector<std::string> args(strings.begin(), strings.begin() + header.arguments);
+        std::vector<std::string> env(strings.begin() + header.arguments, strings.end());
+        if (args.empty())
+        {
+                args.push_back(process.objects_[0].path.string());
+        }
+
+        Trace::Scope scope("launch");
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+                sigprocmask(SIG_SETMASK, mask, nullptr);
+                for (int fd = 0; fd < 3; ++fd)
+                {
+                        if (stdio[fd] >= 0) dup2(stdio[fd], fd);
+                }
+                for (int fd : stdio)
+                {
+                        if (fd > 2) close(fd);
+                }
+                for (int fd : server_fds)
+                {
+                        close(fd);
+                }
+                close(connection);
+                process.start(args, env, stack, STACK_SIZE);
+        }
+        for (int fd : stdio)
+        {
+                if (fd >= 0) close(fd);
+        }
+        if (pid < 0)
+        {
+                LOG_ERROR("fork: %s\n", strerror(errno));
+        }
+        return pid;
+}
+
+int Zygote::launch(const std::filesystem::path & socket_path, const std::vector<std::string> & args, int & status)
+{
+        sockaddr_un address;
+        if (socket_address(socket_path, address) < 0)
+        {
+                return -1;
+        }
+        int connection = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (connection < 0 || connect(connection, (sockaddr *)&address, sizeof(address)) < 0)
+        {
+                LOG_ERROR("Cannot connect to '%s': %s\n", socket_path.c_str(), strerror(errno));
+                if (connection >= 0) close(connection);
+                return -1;
+        }
+
+        Header header;
+        std::string payload;
+        for (const auto & arg : args)
+        {
+                payload.append(arg.c_str(), arg.size() + 1);
+        }
+        header.arguments = args.size();
+        for (char ** variable = environ; *variable != nullptr; ++variable)
+        {
+                payload.append(*variable, strlen(*variable) + 1);
+                ++header.variables;
+        }
+        header.size = payload.size();
+
+        iovec iov = {&header, sizeof(header)};
+        int stdio[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(stdio))] = {};
+        msghdr message = {};
+        message.msg_iov = &iov;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+        cmsghdr * cmsg = CMSG_FIRSTHDR(&message);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(stdio));
+        memcpy(CMSG_DATA(cmsg), stdio, sizeof(stdio));
+
+        int32_t pid = -1;
+        int32_t reply = 0;
+        int ret = sendmsg(connection, &message, MSG_NOSIGNAL) == sizeof(header)
+                && write_all(connection, payload.data(), payload.size()) == 0
+                && read_all(connection, &pid, sizeof(pid)) == 0 && pid > 0
+                && read_all(connection, &reply, sizeof(reply)) == 0 ? 0 : -1;
+        close(connection);
+        if (ret < 0)
+        {
+                LOG_ERROR("Launch through '%s' failed\n", socket_path.c_str());
+                return -1;
+        }
+        status = reply;
+        return 0;
+}
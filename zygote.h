@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <csignal>
+#include <filesystem>
+#include <initializer_list>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+class Process;
+
+// Fork server. The Process is loaded, relocated and protected once, then every
+// launch request received on a Unix socket is one fork() entering the program with
+// the request's arguments and environment: the launch costs a fork and the pages
+// the program dirties, not a load.
+//
+// A request is a Header carrying the client's stdin, stdout and stderr as
+// SCM_RIGHTS, followed by Header::size bytes: NUL terminated arguments then
+// environment strings, at most MAX_REQUEST of them. The reply is the child's pid,
+// then its wait status once it has exited.
+class Zygote
+{
+public:
+        static constexpr size_t STACK_SIZE = 8 << 20;
+        // Larger requests are rejected, a client slower than the timeout is dropped
+        static constexpr size_t MAX_REQUEST = 4 << 20;
+        static constexpr int REQUEST_TIMEOUT_MS = 1000;
+
+        struct Header
+        {
+                uint32_t size = 0;
+                uint32_t arguments = 0;
+                uint32_t variables = 0;
+        };
+
+        // Never returns unless the socket cannot be set up
+        static int serve(Process & process, const std::filesystem::path & socket_path);
+
+        // Client side: runs `args` through the zygote with this process' stdio and
+        // environment, status gets the wait status
+        static int launch(const std::filesystem::path & socket_path, const std::vector<std::string> & args, int & status);
+
+private:
+        static pid_t spawn(Process & process, int connection, std::initializer_list<int> server_fds, const sigset_t * mask, void * stack);
+};